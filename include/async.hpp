@@ -0,0 +1,60 @@
+#ifndef ASYNC_HPP
+#define ASYNC_HPP
+
+#include "scheduler.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// Asynchronous file request
+
+struct AsyncRequest {
+   std::string filename;
+   std::string data;
+   bool write = false, append = false;
+
+   std::atomic<bool> done = false;
+   bool failed = false;
+
+   int file = -1;
+   size_t offset = 0;
+   std::shared_ptr<Scheduler::Job> job; // Blocking fallback only
+};
+
+// Asynchronous file I/O, backed by io_uring on Linux and by the scheduler's thread pool elsewhere,
+// when io_uring is unavailable, or for reads of pipes and devices. Not thread-safe, every instruction
+// pointer owns its own instance.
+
+struct AsyncIO {
+   std::unordered_map<int, std::shared_ptr<AsyncRequest>> requests;
+   int nextTicket = 1;
+
+   int ring = -1;
+   unsigned *sqHead = nullptr, *sqTail = nullptr, *sqMask = nullptr, *sqArray = nullptr;
+   unsigned *cqHead = nullptr, *cqTail = nullptr, *cqMask = nullptr;
+   void *sqEntries = nullptr, *cqEntries = nullptr;
+   void *sqRing = nullptr, *cqRing = nullptr;
+   size_t sqRingSize = 0, cqRingSize = 0, sqEntriesSize = 0;
+   unsigned entries = 0, inFlight = 0;
+
+   AsyncIO();
+   ~AsyncIO();
+
+   int submit(std::shared_ptr<AsyncRequest> request);
+   bool poll(int ticket);
+   std::shared_ptr<AsyncRequest> wait(int ticket);
+   void drain();
+
+private:
+   bool setupRing();
+   void closeRing();
+   void submitRing(int ticket, AsyncRequest &request);
+   void reap(bool block);
+   void finish(AsyncRequest &request, bool failed);
+};
+
+void prefetchFile(const std::string &filename);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef DETECTOR_HPP
+#define DETECTOR_HPP
+
+#include "interpreter.hpp"
+#include <cstdint>
+#include <string>
+
+// Loop detector, hashes the whole interpreter state every few steps and fails the run once a state
+// repeats exactly with no input, output or other outside effect in between. Uses Brent's algorithm, so
+// only one earlier state is kept, and only compared in full when the hashes match.
+
+struct LoopDetector {
+   // Everything that decides what the program does next. Registers and variables are kept as maps,
+   // which compare equal regardless of their order.
+   struct State {
+      std::string ordered; // Position, modes, stacks and frames
+      std::pmr::unordered_map<int, int> registers;
+      std::pmr::unordered_map<std::pmr::string, int> variables;
+
+      bool operator==(const State &state) const = default;
+   };
+
+   uint64_t interval = 1024; // Least steps between checks
+   uint64_t wait = 1024; // Steps until the next check, more than interval for large states
+   uint64_t countdown = 0;
+   uint64_t steps = 0;
+
+   State saved, current;
+   size_t savedHash = 0;
+   bool hasSaved = false;
+   uint64_t savedStep = 0;
+   uint64_t power = 1, length = 0;
+   uint64_t interactions = 0;
+
+   LoopDetector(uint64_t interval);
+
+   void step(const Interpreter &interpreter) {
+      steps += 1;
+      if (++countdown >= wait) {
+         countdown = 0;
+         check(interpreter);
+      }
+   }
+
+   void check(const Interpreter &interpreter);
+   void save(const Interpreter &interpreter, size_t hash);
+   void serialize(const Interpreter &interpreter, std::string &ordered) const;
+   size_t hash(const Interpreter &interpreter);
+
+   // Builtins that only work on the interpreter's own state
+   static bool isDeterministic(const std::pmr::string &function);
+};
+
+#endif
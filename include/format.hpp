@@ -3,8 +3,17 @@
 
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #undef assert
 
+// Error, thrown by raise instead of exiting on threads that don't own the process
+
+struct Error: std::runtime_error {
+   using std::runtime_error::runtime_error;
+};
+
+inline thread_local bool raiseThrows = false;
+
 // String conversion functions
 
 template<typename T>
@@ -36,6 +45,9 @@ void warn(const char *base, const Args&...args) {
 
 template<typename... Args>
 [[noreturn]] void raise(const char *base, const Args&...args) {
+   if (raiseThrows) {
+      throw Error(format(base, args...));
+   }
    std::cout << "ERROR: " << format(base, args...) << '\n';
    std::exit(-1);
 }
@@ -1,11 +1,32 @@
 #ifndef INTERPRETER_HPP
 #define INTERPRETER_HPP
 
+#include "random.hpp"
+#include "scheduler.hpp"
 #include "tokens.hpp"
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
 #include <functional>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <optional>
 #include <stack>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct AsyncIO;
+struct LoopDetector;
+struct Profiler;
+struct Replay;
+struct Session;
+struct Stats;
+struct Trace;
 
 // Vector2
 
@@ -20,34 +41,169 @@ struct Vector2 {
    size_t operator()(const Vector2 &vector) const;
 };
 
+// Frame, where a label call returns to
+
+struct Frame {
+   Vector2 position;
+   Vector2 direction;
+};
+
+// Directory
+
+struct Directory {
+   std::filesystem::directory_iterator iterator;
+   std::string extension;
+   bool filesOnly = false;
+};
+
+// Counting loop, a cycle through a conditional cell whose state changes by the same affine map every
+// iteration. Values are affine in the loop inputs: stack values below the tested one and variables.
+
+struct CountingLoop {
+   // Both are allocator-aware, so the copies kept in 'loops' allocate from the interpreter's resource
+   using allocator_type = std::pmr::polymorphic_allocator<>;
+
+   struct Affine {
+      using allocator_type = std::pmr::polymorphic_allocator<>;
+
+      std::pmr::vector<uint32_t> coefficients; // One per input, arithmetic wraps like int does
+      uint32_t constant = 0;
+
+      Affine(allocator_type allocator = {});
+      Affine(const Affine &affine, allocator_type allocator = {});
+      Affine(Affine &&affine) = default;
+      Affine(Affine &&affine, allocator_type allocator);
+      Affine &operator=(const Affine &affine) = default;
+      Affine &operator=(Affine &&affine) = default;
+   };
+
+   Vector2 direction;
+   bool continueOnNonzero = true;
+   bool usesNumbers = false;
+   int depth = 0;
+   int length = 1; // Cells the PC lands on in one iteration, the conditional included
+
+   std::pmr::vector<int> inputs; // Stack slot from the top, or -1 - variable index
+   std::pmr::vector<std::pmr::string> variables;
+   std::pmr::vector<std::pmr::vector<uint32_t>> transition; // Inputs after one iteration, constant last
+
+   // The loop continues while the sum of signs[i] * operands[i] + offset is nonzero, or positive
+   std::pmr::vector<Affine> operands;
+   std::pmr::vector<int> signs;
+   int offset = 0;
+   bool positive = false;
+
+   CountingLoop(allocator_type allocator = {});
+   CountingLoop(const CountingLoop &loop, allocator_type allocator = {});
+   CountingLoop(CountingLoop &&loop) = default;
+   CountingLoop(CountingLoop &&loop, allocator_type allocator);
+   CountingLoop &operator=(const CountingLoop &loop) = default;
+   CountingLoop &operator=(CountingLoop &&loop) = default;
+};
+
+// Memo, results of a label that only works on the stack, keyed on the values it consumes
+
+struct MemoHash {
+   size_t operator()(const std::pmr::vector<int> &values) const;
+};
+
+struct Memo {
+   // Allocator-aware like CountingLoop, so the entries in 'memos' keep their results in the interpreter's resource
+   using allocator_type = std::pmr::polymorphic_allocator<>;
+
+   static constexpr size_t capacity = 4096; // Results kept per label, the table starts over when full
+
+   int consumed = 0; // Values below the call the label reads or pops
+   int produced = 0; // Values it leaves in their place
+   std::pmr::unordered_map<std::pmr::vector<int>, std::pmr::vector<int>, MemoHash> results;
+
+   Memo(allocator_type allocator = {});
+   Memo(const Memo &memo, allocator_type allocator = {});
+   Memo(Memo &&memo) = default;
+   Memo(Memo &&memo, allocator_type allocator);
+   Memo &operator=(const Memo &memo) = default;
+   Memo &operator=(Memo &&memo) = default;
+};
+
+// Call to a memoized label whose result is stored once it returns
+
+struct MemoCall {
+   Memo *memo = nullptr;
+   std::pmr::vector<int> inputs; // From the interpreter's resource, moved into the results as is
+   size_t frames = 0; // Size of jumps with the call's frame on top
+};
+
+// Stack
+
+template<typename T, typename Container = std::pmr::deque<T>>
+struct Stack: public std::stack<T, Container> {
+   using std::stack<T, Container>::stack;
+   using std::stack<T, Container>::c;
+};
+
 // Interpreter
 
 struct Interpreter {
    static std::unordered_map<char, Token::Type> tokenTypes;
-   std::unordered_map<Token::Type, std::function<void(char)>> commands;
-   std::unordered_map<std::string, std::function<void()>> functions;
 
-   std::unordered_map<std::string, Vector2> labels;
+   // Every container below allocates from this resource, so a run can live in a single arena
+   std::pmr::memory_resource *resource;
+
+   std::pmr::unordered_map<Token::Type, std::function<void(char)>> commands;
+   std::pmr::unordered_map<std::pmr::string, std::function<void()>> functions;
+
+   std::pmr::unordered_map<std::pmr::string, Vector2> labels;
+   std::pmr::vector<std::pmr::string> constants;
+   std::pmr::unordered_map<Vector2, std::array<int, 4>, Vector2> literals;
+   std::pmr::unordered_map<Vector2, std::pmr::vector<CountingLoop>, Vector2> loops;
+   std::pmr::unordered_map<std::pmr::string, Memo> memos;
 
-   std::unordered_map<Vector2, Token, Vector2> map;
-   std::unordered_map<int, int> registers;
-   std::unordered_map<std::string, int> variables;
+   std::pmr::unordered_map<Vector2, Token, Vector2> map;
+   std::pmr::unordered_map<int, int> registers;
+   std::pmr::unordered_map<std::pmr::string, int> variables;
 
-   std::stack<Vector2> jumps;
-   std::stack<Token> defered;
-   std::stack<int> stack;
+   std::pmr::unordered_map<int, Directory> directories;
+   int nextDirectory = 1;
+
+   std::unique_ptr<AsyncIO> async;
+   std::pmr::unordered_map<int, std::unique_ptr<Interpreter>> children;
+   int nextChild = 1;
+
+   Stack<Frame, std::pmr::vector<Frame>> jumps;
+   Stack<MemoCall> memoCalls;
+   Stack<Token> defered;
+   Stack<int> stack;
+
+   Random random;
+   Trace *trace = nullptr;
+   Stats *stats = nullptr;
+   Replay *replay = nullptr;
+   Profiler *profiler = nullptr;
+   LoopDetector *detector = nullptr;
+
+   std::ostream *output = &std::cout;
+   std::pmr::string input;
+   bool suspendOnInput = false, inputClosed = false, waitingForInput = false, resuming = false;
 
    Vector2 position, direction;
-   std::string temporaryString, numberString, identifier;
+   std::pmr::string temporaryString, numberString, identifier;
 
    bool stringmode = false, outputString = false, reverseString = false;
    bool numbermode = false, hexadecimalNumber = false;
    bool identifiermode = false, gettingVariable = false, callingFunction = false, gettingLabelPos = false;
    bool defermode = false;
 
+   bool ownsProcess = true, terminated = false;
+   uint64_t interactions = 0; // Input, output and builtins with outside effects, the loop detector starts over when this changes
+
+   // Set on IPs started by split, which run on the scheduler's pool
+   std::shared_ptr<Scheduler::Job> job;
+   std::string failure;
+
    // Init commands
 
-   Interpreter();
+   Interpreter(std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+   ~Interpreter();
    void initCommands();
    void initFunctions();
 
@@ -55,20 +211,73 @@ struct Interpreter {
 
    void lex(const std::string &code);
    Token lexCommand(char character);
+   void lexLiterals();
 
    // Interpreter
 
    void run(const std::string &code);
+   void execute();
+   void step();
    void runCommand(Token command);
+   bool runLiteral();
+
+   // Sessions
+
+   Session session(std::string code); // By value, the coroutine only lexes it once first resumed
+   void feed(std::string_view data);
+   void closeInput();
+
+   bool inputReady(Token::Type type);
+   int readInteger();
+   int readCharacter();
+   std::string readLine();
+
+   // Call analysis
+
+   void analyzeJumps();
+   bool reachesReturn(Vector2 start, const std::unordered_map<std::string, bool> &returns, Vector2 size) const;
+
+   // Memoization
+
+   void analyzeMemos();
+   bool memoEffect(Vector2 start, const std::unordered_map<std::string, std::pair<int, int>> &effects, const std::unordered_set<std::string> &impure, std::optional<std::pair<int, int>> &effect) const;
+   bool recallMemo(Token command);
+   void storeMemo();
+
+   // Loop acceleration
+
+   void analyzeLoops();
+   bool analyzeLoop(Vector2 cell, Vector2 direction, bool continueOnNonzero, CountingLoop &loop) const;
+   bool accelerateLoop();
+
+   // Instruction pointers
+
+   int split();
+   std::unique_ptr<Interpreter> join(int handle);
+   void joinAll();
+   void runChild();
 
    // Utility functions
 
    void forward();
    void back();
+   Token tokenAt(Vector2 cell) const;
+   int directionIndex(Vector2 vector) const;
    int pop();
    int top();
    void push(int value);
 
+   std::string popString(const std::string &function);
+   void pushString(const std::string &string);
+   std::pair<std::pmr::deque<int>::iterator, std::pmr::deque<int>::iterator> topString(const std::string &function);
+
+   std::vector<int> getRegisters(int start, int count);
+   void putRegisters(int start, const std::vector<int> &values);
+   void fillRegisters(int start, int count, int value);
+   void copyRegisters(int source, int destination, int count);
+   void assertRegisterRange(int start, int count, const std::string &function);
+
+   AsyncIO &asyncIO();
    void assertStackSize(size_t minimum, char operatorc);
    void assertStackSize(size_t minimum, const std::string &function);
    bool isHexadecimal(char character);
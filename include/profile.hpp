@@ -0,0 +1,29 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include "interpreter.hpp"
+#include <csignal>
+#include <cstdint>
+#include <map>
+#include <string>
+
+// Profiler, samples the label call stack on SIGPROF and writes folded stacks on exit
+
+struct Profiler {
+   static constexpr int frequency = 1000; // Samples per second of CPU time
+
+   // Set by the signal handler, the interpreter takes the sample at its next step
+   static inline volatile std::sig_atomic_t pending = 0;
+
+   std::string filename;
+   std::map<std::string, uint64_t> samples;
+   uint64_t count = 0;
+
+   Profiler(const std::string &filename);
+
+   void sample(const Interpreter &interpreter);
+   void write();
+   static void install(Profiler *profiler);
+};
+
+#endif
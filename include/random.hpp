@@ -0,0 +1,19 @@
+#ifndef RANDOM_HPP
+#define RANDOM_HPP
+
+#include <cstdint>
+
+// xoshiro256** generator, one per interpreter so instances don't share any state
+
+struct Random {
+   uint64_t state[4] {};
+
+   void seed(uint64_t value);
+   uint64_t next();
+
+   int integer();
+   int range(int min, int max);
+   bool condition();
+};
+
+#endif
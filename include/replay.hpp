@@ -0,0 +1,53 @@
+#ifndef REPLAY_HPP
+#define REPLAY_HPP
+
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <streambuf>
+#include <string>
+
+// Stream buffer that forwards to another buffer and keeps a copy of everything written
+
+struct TeeBuffer: public std::streambuf {
+   std::streambuf *target = nullptr;
+   std::string captured;
+
+protected:
+   int overflow(int character) override;
+   std::streamsize xsputn(const char *data, std::streamsize size) override;
+   int sync() override;
+};
+
+// Replay, records every nondeterministic input of a run to a log and feeds it back later
+
+struct Replay {
+   struct Event {
+      char kind = 0;
+      std::string value;
+   };
+
+   enum class Mode { record, replay };
+
+   Mode mode;
+   std::string filename;
+   std::ofstream log;
+   std::deque<Event> events;
+   std::string expectedOutput;
+   TeeBuffer output;
+   std::streambuf *originalOutput = nullptr;
+
+   Replay(Mode mode, const std::string &filename);
+
+   int integer(char kind, const std::function<int()> &live);
+   std::string text(char kind, const std::function<std::string()> &live);
+
+   void finish();
+   static void install(Replay *replay);
+
+private:
+   void write(char kind, const std::string &value);
+   Event next(char kind);
+};
+
+#endif
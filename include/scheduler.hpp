@@ -0,0 +1,50 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Scheduler, work-stealing pool of OS threads. Every worker owns a queue it
+// pushes to and pops from the back of, idle workers steal from the front of
+// other queues. Threads outside the pool share one extra queue.
+
+struct Scheduler {
+   // A job runs once, on whichever thread claims it first: a worker, or a
+   // thread waiting for it that finds it still queued
+   struct Job {
+      std::function<void()> task;
+      std::atomic<bool> claimed = false, done = false;
+   };
+
+   struct Queue {
+      std::mutex mutex;
+      std::deque<std::shared_ptr<Job>> jobs;
+   };
+
+   std::vector<std::unique_ptr<Queue>> queues;
+   size_t workers = 0;
+
+   std::mutex sleepMutex;
+   std::condition_variable sleep;
+   std::atomic<size_t> pending = 0;
+
+   Scheduler(size_t workers);
+
+   static Scheduler &instance();
+   std::shared_ptr<Job> submit(std::function<void()> task);
+   void wait(Job &job);
+   bool runOne();
+
+private:
+   static void run(Job &job);
+   size_t ownQueue() const;
+   void work(size_t index);
+};
+
+#endif
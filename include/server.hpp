@@ -0,0 +1,31 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include "interpreter.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// Server, lexes programs once and runs each request in a pre-forked worker listening on a Unix socket.
+// A request is the program name on its own line, followed by the program's input; the connection
+// receives the program's output. Every worker serves one request and is then replaced, a request that
+// runs past its deadline or whose client hung up ends its worker early.
+
+struct Server {
+   std::string path;
+   int workers = 4;
+   unsigned timeout = 30; // Seconds a request may take, 0 for no limit
+   std::unordered_map<std::string, std::unique_ptr<Interpreter>> programs;
+   int listener = -1;
+
+   Server(const std::string &path, int workers, unsigned timeout);
+
+   void load(const std::string &file);
+   [[noreturn]] void run();
+
+private:
+   void spawn();
+   [[noreturn]] void work();
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef SESSION_HPP
+#define SESSION_HPP
+
+#include <coroutine>
+#include <string>
+
+// Session, an interpreter run as a coroutine that suspends whenever the program waits for input. Errors
+// end only the session, the host gets them from error() instead of the process exiting.
+
+struct Session {
+   struct promise_type {
+      std::string error; // Why the program failed, empty while it runs or once it ended with 'E'
+
+      Session get_return_object();
+      std::suspend_always initial_suspend() noexcept { return {}; }
+      std::suspend_always final_suspend() noexcept { return {}; }
+      void return_void() {}
+      void unhandled_exception();
+   };
+
+   std::coroutine_handle<promise_type> handle;
+
+   explicit Session(std::coroutine_handle<promise_type> handle);
+   Session(Session &&other) noexcept;
+   Session &operator=(Session &&other) noexcept;
+   Session(const Session &) = delete;
+   Session &operator=(const Session &) = delete;
+   ~Session();
+
+   bool resume(); // Runs until the program waits for input or ends, returns false once it has ended
+   bool done() const;
+   std::string error() const;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include "interpreter.hpp"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// Size of an interpreter structure, final and highest seen
+
+struct StatsSize {
+   size_t final = 0;
+   size_t peak = 0;
+
+   void update(size_t size) {
+      final = size;
+      peak = (size > peak ? size : peak);
+   }
+};
+
+// Stats, runtime counters reported on exit
+
+struct Stats {
+   using Clock = std::chrono::steady_clock;
+
+   const Interpreter *interpreter = nullptr;
+   bool json = false;
+
+   uint64_t steps = 0;
+   Clock::time_point lexStart, runStart;
+   Clock::duration lexTime {};
+
+   StatsSize map, stack, defered, jumps, registers, variables;
+   std::unordered_map<std::string, uint64_t> functionCalls;
+   uint64_t bytesRead = 0, bytesWritten = 0;
+
+   void beginLex();
+   void beginRun();
+
+   void step() {
+      steps += 1;
+      sample();
+   }
+
+   void sample() {
+      map.update(interpreter->map.size());
+      stack.update(interpreter->stack.size());
+      defered.update(interpreter->defered.size());
+      jumps.update(interpreter->jumps.size());
+      registers.update(interpreter->registers.size());
+      variables.update(interpreter->variables.size());
+   }
+
+   void report() const;
+   static void install(Stats *stats);
+};
+
+#endif
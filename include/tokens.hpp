@@ -18,6 +18,8 @@ struct Token {
 
    Type type = Type::empty;
    char value = 0;
+   bool accelerated = false; // Conditional cell that closes a counting loop, see Interpreter::loops
+   unsigned char frameless = 0; // Directions, as bits, in which a ';label' ended by this cell pushes no frame
 };
 
 constexpr const char *tokenTypeStrings[] {
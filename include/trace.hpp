@@ -0,0 +1,42 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// Trace record, one per executed cell
+
+struct TraceRecord {
+   int32_t x = 0, y = 0;
+   int32_t top = 0;
+   int8_t dx = 0, dy = 0;
+   char opcode = 0;
+   uint8_t padding = 0;
+};
+
+// Trace, fixed-size ring of the last executed cells, dumped to a file on exit or on a fatal signal
+
+struct Trace {
+   static constexpr uint32_t magic = 0x52544644; // "DFTR"
+   static constexpr uint32_t version = 1;
+   static constexpr size_t capacity = 1 << 16;
+
+   std::array<TraceRecord, capacity> records;
+   uint64_t count = 0;
+   std::string filename;
+
+   Trace(const std::string &filename);
+
+   void record(int x, int y, int dx, int dy, char opcode, int top) {
+      records[count & (capacity - 1)] = {x, y, top, static_cast<int8_t>(dx), static_cast<int8_t>(dy), opcode, 0};
+      count += 1;
+   }
+
+   void dump() const;
+   static void install(Trace *trace);
+};
+
+void decodeTrace(const std::string &traceFile, const std::string &code);
+
+#endif
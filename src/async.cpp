@@ -0,0 +1,313 @@
+#include "async.hpp"
+#include "format.hpp" // IWYU pragma: export
+#include "scheduler.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+// Blocking fallback, runs on the scheduler's thread pool
+
+static void runBlocking(AsyncRequest &request) {
+   if (request.write) {
+      std::ofstream file (request.filename, std::ios::out | (request.append ? std::ios::app : std::ios::trunc));
+      request.failed = !file.is_open() || !(file << request.data);
+   } else {
+      // A pipe the ring path already opened has to be read from that descriptor, reopening it could lose data
+      int file = (request.file >= 0 ? request.file : open(request.filename.c_str(), O_RDONLY | O_CLOEXEC));
+      request.file = -1;
+      request.failed = (file < 0);
+
+      char buffer[1 << 16];
+      ssize_t size = 0;
+      while (file >= 0 && (size = read(file, buffer, sizeof(buffer))) != 0) {
+         if (size < 0 && errno != EINTR) {
+            request.failed = true;
+            break;
+         }
+         if (size > 0) {
+            request.data.append(buffer, size);
+         }
+      }
+
+      if (file >= 0) {
+         close(file);
+      }
+   }
+   request.done = true;
+}
+
+// Async I/O
+
+AsyncIO::AsyncIO() {
+   setupRing();
+}
+
+AsyncIO::~AsyncIO() {
+   drain();
+   closeRing();
+}
+
+void AsyncIO::drain() {
+   // Requests still in flight write into their buffers, so drain them before those are freed
+   while (ring >= 0 && inFlight > 0) {
+      reap(true);
+   }
+
+   for (auto &[ticket, request]: requests) {
+      if (request->job) {
+         Scheduler::instance().wait(*request->job);
+      }
+   }
+}
+
+int AsyncIO::submit(std::shared_ptr<AsyncRequest> request) {
+   int ticket = nextTicket++;
+   requests[ticket] = request;
+
+   if (ring >= 0) {
+      int flags = (request->write ? O_WRONLY | O_CREAT | (request->append ? O_APPEND : O_TRUNC) : O_RDONLY);
+      request->file = open(request->filename.c_str(), flags | O_CLOEXEC, 0644);
+      if (request->file < 0) {
+         finish(*request, true);
+         return ticket;
+      }
+
+      if (request->write) {
+         if (request->data.empty()) {
+            finish(*request, false);
+         } else {
+            submitRing(ticket, *request);
+         }
+         return ticket;
+      }
+
+      struct stat status {};
+      if (fstat(request->file, &status) < 0) {
+         finish(*request, true);
+         return ticket;
+      }
+
+      // Files in /proc report a size of 0, so the size is only a first guess and reads go on until one
+      // comes back empty. Pipes and devices can't be read at an offset, those go to the thread pool.
+      if (S_ISREG(status.st_mode)) {
+         request->data.resize(std::max<size_t>(status.st_size + 1, 4096));
+         submitRing(ticket, *request);
+         return ticket;
+      }
+   }
+
+   request->job = Scheduler::instance().submit([request]() {
+      runBlocking(*request);
+   });
+   return ticket;
+}
+
+bool AsyncIO::poll(int ticket) {
+   auto it = requests.find(ticket);
+   assert(it != requests.end(), "'poll': Ticket {} does not exist or was already awaited.", ticket);
+
+   if (ring >= 0 && inFlight > 0) {
+      reap(false);
+   }
+   return it->second->done;
+}
+
+std::shared_ptr<AsyncRequest> AsyncIO::wait(int ticket) {
+   auto it = requests.find(ticket);
+   assert(it != requests.end(), "'await': Ticket {} does not exist or was already awaited.", ticket);
+
+   std::shared_ptr<AsyncRequest> request = it->second;
+   if (request->job) {
+      Scheduler::instance().wait(*request->job);
+   } else {
+      while (!request->done) {
+         reap(true);
+      }
+   }
+
+   requests.erase(ticket);
+   return request;
+}
+
+void AsyncIO::finish(AsyncRequest &request, bool failed) {
+   if (request.file >= 0) {
+      close(request.file);
+      request.file = -1;
+   }
+   request.failed = failed;
+   request.done = true;
+}
+
+#ifdef __linux__
+
+bool AsyncIO::setupRing() {
+   io_uring_params params {};
+   ring = syscall(__NR_io_uring_setup, 64, &params);
+   if (ring < 0) {
+      return false;
+   }
+
+   entries = params.sq_entries;
+   sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+   cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+   if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+   }
+
+   sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+   cqRing = sqRing;
+   if (sqRing != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+      cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+   }
+
+   sqEntriesSize = params.sq_entries * sizeof(io_uring_sqe);
+   sqEntries = mmap(nullptr, sqEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+
+   if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqEntries == MAP_FAILED) {
+      closeRing();
+      return false;
+   }
+
+   char *sq = static_cast<char *>(sqRing);
+   char *cq = static_cast<char *>(cqRing);
+   sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+   sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+   sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+   sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+   cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+   cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+   cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+   cqEntries = cq + params.cq_off.cqes;
+   return true;
+}
+
+void AsyncIO::submitRing(int ticket, AsyncRequest &request) {
+   // Keep the completion queue from overflowing by draining it once the ring is full
+   while (inFlight >= entries) {
+      reap(true);
+   }
+
+   unsigned tail = *sqTail;
+   unsigned index = tail & *sqMask;
+   io_uring_sqe &entry = static_cast<io_uring_sqe *>(sqEntries)[index];
+
+   entry = {};
+   entry.opcode = (request.write ? IORING_OP_WRITE : IORING_OP_READ);
+   entry.fd = request.file;
+   entry.off = request.offset;
+   entry.addr = reinterpret_cast<uint64_t>(request.data.data() + request.offset);
+   entry.len = request.data.size() - request.offset;
+   entry.user_data = ticket;
+
+   sqArray[index] = index;
+   __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+   inFlight += 1;
+
+   // The kernel may read the entry as soon as the tail moves past it, so it can't be taken back
+   long submitted;
+   do {
+      submitted = syscall(__NR_io_uring_enter, ring, 1, 0, 0, nullptr, 0);
+   } while (submitted < 0 && errno == EINTR);
+   assert(submitted >= 0, "Failed to submit the request for file '{}': {}.", request.filename, std::strerror(errno));
+}
+
+void AsyncIO::reap(bool block) {
+   if (block) {
+      long result;
+      do {
+         result = syscall(__NR_io_uring_enter, ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+      } while (result < 0 && errno == EINTR);
+      assert(result >= 0, "Failed to wait for file requests: {}.", std::strerror(errno));
+   }
+
+   unsigned head = *cqHead;
+   while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+      io_uring_cqe &completion = static_cast<io_uring_cqe *>(cqEntries)[head & *cqMask];
+      int ticket = completion.user_data;
+      int result = completion.res;
+
+      head += 1;
+      __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+      inFlight -= 1;
+
+      auto it = requests.find(ticket);
+      if (it == requests.end()) {
+         continue;
+      }
+      AsyncRequest &request = *it->second;
+
+      if (result < 0 || (result == 0 && request.write)) {
+         finish(request, true);
+      } else if (result == 0) {
+         // End of file
+         request.data.resize(request.offset);
+         finish(request, false);
+      } else {
+         request.offset += result;
+         if (!request.write && request.offset == request.data.size()) {
+            request.data.resize(request.data.size() * 2);
+         }
+
+         if (request.offset < request.data.size()) {
+            submitRing(ticket, request);
+         } else {
+            finish(request, false);
+         }
+      }
+   }
+}
+
+void AsyncIO::closeRing() {
+   // Also used when setting up the ring failed part of the way
+   if (sqEntries && sqEntries != MAP_FAILED) {
+      munmap(sqEntries, sqEntriesSize);
+   }
+   if (cqRing && cqRing != MAP_FAILED && cqRing != sqRing) {
+      munmap(cqRing, cqRingSize);
+   }
+   if (sqRing && sqRing != MAP_FAILED) {
+      munmap(sqRing, sqRingSize);
+   }
+   if (ring >= 0) {
+      close(ring);
+   }
+
+   ring = -1;
+   sqEntries = cqRing = sqRing = nullptr;
+}
+
+#else
+
+bool AsyncIO::setupRing() {
+   return false;
+}
+
+void AsyncIO::closeRing() {}
+
+void AsyncIO::submitRing(int, AsyncRequest &) {}
+void AsyncIO::reap(bool) {}
+
+#endif
+
+void prefetchFile(const std::string &filename) {
+   int file = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+   if (file < 0) {
+      return;
+   }
+
+   #ifdef __linux__
+   posix_fadvise(file, 0, 0, POSIX_FADV_WILLNEED);
+   #endif
+   close(file);
+}
@@ -0,0 +1,194 @@
+#include "format.hpp" // IWYU pragma: export
+#include "interpreter.hpp"
+#include <unordered_set>
+#include <utility>
+
+// Commands that can end a ';label' without moving the PC or changing modes. The cell ending an identifier
+// runs right after the jump, so anything else would change where the label starts executing.
+static bool isPlain(Token::Type type) {
+   switch (type) {
+      case Token::invalid:
+      case Token::right: case Token::left: case Token::up: case Token::down:
+      case Token::rightCondition: case Token::leftCondition: case Token::upCondition: case Token::downCondition:
+      case Token::bridge: case Token::return_: case Token::terminate:
+      case Token::stringmode: case Token::numbermode:
+      case Token::define: case Token::getVariable: case Token::callFunction: case Token::jumpToLabel:
+      case Token::defer: case Token::deferRun: case Token::deferRunOne:
+         return false;
+      default:
+         return true;
+   }
+}
+
+static bool isIdentifier(char character) {
+   return std::isalnum(character) || character == '_';
+}
+
+// Analysis
+
+void Interpreter::analyzeJumps() {
+   Vector2 size;
+   for (auto &[cell, token]: map) {
+      size.x = std::max(size.x, cell.x + 1);
+      size.y = std::max(size.y, cell.y + 1);
+   }
+
+   // A label returns if an 'R' is reachable at its own level, where a call only comes back if its label
+   // returns. Starting from no label returning and growing the set until it is stable finds every label
+   // that can return; the frames for the others are never popped.
+   std::unordered_map<std::string, bool> returns;
+   for (auto &[name, position]: labels) {
+      returns[std::string(name)] = false;
+   }
+
+   bool changed = true;
+   while (changed) {
+      changed = false;
+      for (auto &[name, position]: labels) {
+         bool &label = returns[std::string(name)];
+         if (!label && reachesReturn(position, returns, size)) {
+            label = changed = true;
+         }
+      }
+   }
+
+   const Vector2 directions[] {{1, 0}, {-1, 0}, {0, -1}, {0, 1}};
+   for (auto &[cell, token]: map) {
+      if (token.type != Token::jumpToLabel) {
+         continue;
+      }
+
+      for (const Vector2 &step: directions) {
+         std::string name;
+         Vector2 end = {cell.x + step.x, cell.y + step.y};
+         while (isIdentifier(tokenAt(end).value)) {
+            name += tokenAt(end).value;
+            end = {end.x + step.x, end.y + step.y};
+         }
+
+         auto terminator = map.find(end);
+         if (!returns.contains(name) || terminator == map.end() || !isPlain(terminator->second.type)) {
+            continue;
+         }
+
+         // In a tail call the label returns straight into an 'R', which can pop the caller's frame itself
+         Vector2 next = {end.x + step.x, end.y + step.y};
+         while (tokenAt(next).type == Token::empty && next.x >= 0 && next.y >= 0 && next.x < size.x && next.y < size.y) {
+            next = {next.x + step.x, next.y + step.y};
+         }
+
+         if (!returns[name] || tokenAt(next).type == Token::return_) {
+            terminator->second.frameless |= 1 << directionIndex(step);
+         }
+      }
+   }
+}
+
+bool Interpreter::reachesReturn(Vector2 start, const std::unordered_map<std::string, bool> &returns, Vector2 size) const {
+   auto inside = [&size](Vector2 cell) {
+      return cell.x >= 0 && cell.y >= 0 && cell.x < size.x && cell.y < size.y;
+   };
+   auto advance = [](Vector2 &cell, Vector2 direction) {
+      cell = {cell.x + direction.x, cell.y + direction.y};
+   };
+
+   std::vector<std::pair<Vector2, Vector2>> pending {{start, {1, 0}}};
+   std::unordered_set<long long> visited;
+
+   while (!pending.empty()) {
+      auto [cell, direction] = pending.back();
+      pending.pop_back();
+
+      // Off the playfield the PC runs through empty cells forever
+      while (inside(cell)) {
+         long long state = ((static_cast<long long>(cell.y) * size.x + cell.x) << 2) | directionIndex(direction);
+         if (!visited.insert(state).second) {
+            break;
+         }
+
+         Token command = tokenAt(cell);
+         bool ended = false;
+
+         switch (command.type) {
+            // Deferred commands could be anything, including an 'R'
+            case Token::return_:
+            case Token::defer:
+            case Token::deferRun:
+            case Token::deferRunOne:
+               return true;
+
+            case Token::invalid:
+            case Token::terminate:
+               ended = true;
+               break;
+
+            case Token::right: direction = {1, 0}; break;
+            case Token::left: direction = {-1, 0}; break;
+            case Token::up: direction = {0, -1}; break;
+            case Token::down: direction = {0, 1}; break;
+            case Token::rightCondition: pending.push_back({{cell.x + 1, cell.y}, {1, 0}}); break;
+            case Token::leftCondition: pending.push_back({{cell.x - 1, cell.y}, {-1, 0}}); break;
+            case Token::upCondition: pending.push_back({{cell.x, cell.y - 1}, {0, -1}}); break;
+            case Token::downCondition: pending.push_back({{cell.x, cell.y + 1}, {0, 1}}); break;
+            case Token::bridge:
+               advance(cell, direction);
+               break;
+
+            case Token::stringmode:
+               do {
+                  advance(cell, direction);
+               } while (inside(cell) && tokenAt(cell).type != Token::stringmode);
+               break;
+
+            case Token::numbermode: {
+               // Hexadecimal digits are skipped too, none of them moves the PC
+               bool first = true;
+               do {
+                  advance(cell, direction);
+                  char value = tokenAt(cell).value;
+                  if (!(std::isxdigit(value) || (first && value == 'X'))) {
+                     break;
+                  }
+                  first = false;
+               } while (inside(cell));
+               continue;
+            }
+
+            case Token::define:
+            case Token::getVariable:
+            case Token::callFunction:
+               do {
+                  advance(cell, direction);
+               } while (isIdentifier(tokenAt(cell).value));
+               continue;
+
+            case Token::jumpToLabel: {
+               std::string name;
+               advance(cell, direction);
+               while (isIdentifier(tokenAt(cell).value)) {
+                  name += tokenAt(cell).value;
+                  advance(cell, direction);
+               }
+
+               // The ending cell runs inside the label, the call continues after it once the label returns
+               auto label = returns.find(name);
+               if (label == returns.end() || !label->second) {
+                  ended = true;
+               } else if (!isPlain(tokenAt(cell).type)) {
+                  return true;
+               }
+               break;
+            }
+
+            default:
+               break;
+         }
+
+         if (ended) {
+            break;
+         }
+         advance(cell, direction);
+      }
+   }
+   return false;
+}
@@ -1,12 +1,8 @@
+#include "async.hpp"
 #include "format.hpp" // IWYU pragma: export
 #include "interpreter.hpp"
+#include "replay.hpp"
 #include <cmath>
-#include <limits>
-
-#ifdef __linux__
-#include <termios.h>
-#include <unistd.h>
-#endif
 
 // Globals
 
@@ -76,10 +72,14 @@ void Interpreter::initCommands() {
          position = {-1, 0};
          direction = {1, 0};
       } else {
-         position = jumps.top();
-         jumps.pop();
-         direction = jumps.top();
+         if (!memoCalls.empty() && memoCalls.top().frames == jumps.size()) {
+            storeMemo();
+         }
+
+         Frame frame = jumps.top();
          jumps.pop();
+         position = frame.position;
+         direction = frame.direction;
       }
    };
 
@@ -141,7 +141,8 @@ void Interpreter::initCommands() {
       if (stringmode) {
          for (auto it = temporaryString.rbegin(); it != temporaryString.rend(); ++it) {
             if (outputString) {
-               std::cout << *it;
+               *output << *it;
+               interactions += 1;
             } else {
                push(*it);
             }
@@ -171,8 +172,20 @@ void Interpreter::initCommands() {
    commands[Token::pop] = [this](char) {
       pop();
    };
-   commands[Token::terminate] = [](char) {
-      std::cout << std::flush;
+   commands[Token::terminate] = [this](char) {
+      // IPs started by this one end first, so none outlives the program and their errors are reported
+      joinAll();
+
+      // Writes still in flight finish too, the program may exit right after this
+      if (async) {
+         async->drain();
+      }
+
+      if (!ownsProcess) {
+         terminated = true;
+         return;
+      }
+      *output << std::flush;
       std::exit(0);
    };
    commands[Token::getRegister] = [this](char value) {
@@ -190,11 +203,13 @@ void Interpreter::initCommands() {
 
    commands[Token::outputInteger] = [this](char value) {
       assertStackSize(1, value);
-      std::cout << pop(); 
+      *output << pop(); 
+      interactions += 1;
    };
    commands[Token::outputAscii] = [this](char value) {
       assertStackSize(1, value);
-      std::cout << static_cast<char>(pop());
+      *output << static_cast<char>(pop());
+      interactions += 1;
    };
    commands[Token::outputString] = [this](char) {
       outputString = !outputString;
@@ -203,30 +218,35 @@ void Interpreter::initCommands() {
    // Input commands
 
    commands[Token::integerInput] = [this](char) {
-      int num = 0;
-      std::cin >> num;
-      std::cin.clear();
-      std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-      push(num);
+      if (!inputReady(Token::integerInput)) {
+         return;
+      }
+      auto read = [this]() {
+         return readInteger();
+      };
+      push((replay ? replay->integer('I', read) : read()));
+      interactions += 1;
    };
    commands[Token::asciiInput] = [this](char) {
-      #ifdef __linux__
-      termios oldt, newt;
-      tcgetattr(STDIN_FILENO, &oldt);
-      newt = oldt;
-      newt.c_lflag &= ~(ICANON | ECHO);
-
-      tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-      char ch = getchar();
-      tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-      #else
-      char ch = getchar();
-      #endif
-      push(ch);
+      if (!inputReady(Token::asciiInput)) {
+         return;
+      }
+      auto read = [this]() {
+         return readCharacter();
+      };
+      push((replay ? replay->integer('C', read) : read()));
+      interactions += 1;
    };
    commands[Token::stringInput] = [this](char) {
-      std::string input;
-      std::getline(std::cin, input);
+      if (!inputReady(Token::stringInput)) {
+         return;
+      }
+      auto read = [this]() {
+         return readLine();
+      };
+
+      std::string input = (replay ? replay->text('S', read) : read());
+      interactions += 1;
       for (auto it = input.rbegin(); it != input.rend(); ++it) {
          push(*it);
       }
@@ -242,6 +262,12 @@ void Interpreter::initCommands() {
          Token command = defered.top();
          defered.pop();
          runCommand(command);
+
+         // Put an input command back so it runs again once the session has been fed
+         if (waitingForInput) {
+            defered.push(command);
+            return;
+         }
       }
    };
    commands[Token::deferRunOne] = [this](char) {
@@ -249,6 +275,10 @@ void Interpreter::initCommands() {
          Token command = defered.top();
          defered.pop();
          runCommand(command);
+
+         if (waitingForInput) {
+            defered.push(command);
+         }
       }
    };
    commands[Token::deferGet] = [this](char value) {
@@ -0,0 +1,141 @@
+#include "detector.hpp"
+#include "format.hpp" // IWYU pragma: export
+#include <algorithm>
+#include <type_traits>
+#include <unordered_set>
+
+template<typename T>
+static void append(std::string &state, const T &value) {
+   static_assert(std::is_trivially_copyable_v<T>);
+   state.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void appendString(std::string &state, std::string_view value) {
+   append(state, value.size());
+   state.append(value);
+}
+
+// Spreads the bits of a value, so sums of mixed values make a good order-independent hash
+static uint64_t mix(uint64_t value) {
+   value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+   value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+   return value ^ (value >> 31);
+}
+
+LoopDetector::LoopDetector(uint64_t interval): interval(interval), wait(interval) {}
+
+void LoopDetector::check(const Interpreter &interpreter) {
+   // Anything that touched the outside world may change what happens next, so start over
+   if (interpreter.interactions != interactions) {
+      interactions = interpreter.interactions;
+      hasSaved = false;
+      wait = interval;
+      return;
+   }
+
+   // Checks are at least as far apart as the state is large, so hashing it costs about the same per
+   // step for any state. The spacing only depends on the state, so a repeating state still gets checked
+   // at the same points of the loop every time around.
+   uint64_t size = interpreter.stack.size() + interpreter.defered.size() + interpreter.jumps.size() + interpreter.registers.size() + interpreter.variables.size();
+   wait = std::max(interval, size);
+
+   size_t currentHash = hash(interpreter);
+   if (!hasSaved) {
+      save(interpreter, currentHash);
+      power = 1;
+      length = 0;
+      return;
+   }
+
+   if (currentHash == savedHash) {
+      current.registers = interpreter.registers;
+      current.variables = interpreter.variables;
+
+      if (current == saved) {
+         raise("Infinite loop: The state at step {} repeats the state at step {}, {} steps earlier, without any input or output in between. Position: X: {} Y: {}, direction: X: {} Y: {}.",
+               steps, savedStep, steps - savedStep, interpreter.position.x, interpreter.position.y, interpreter.direction.x, interpreter.direction.y);
+      }
+   }
+
+   // Brent's algorithm, the saved state moves ahead whenever the distance reaches a power of two
+   length += 1;
+   if (length == power) {
+      save(interpreter, currentHash);
+      power *= 2;
+      length = 0;
+   }
+}
+
+void LoopDetector::save(const Interpreter &interpreter, size_t hash) {
+   serialize(interpreter, saved.ordered);
+   saved.registers = interpreter.registers;
+   saved.variables = interpreter.variables;
+
+   savedHash = hash;
+   savedStep = steps;
+   hasSaved = true;
+}
+
+void LoopDetector::serialize(const Interpreter &interpreter, std::string &state) const {
+   state.clear();
+
+   append(state, interpreter.position);
+   append(state, interpreter.direction);
+   append(state, interpreter.random.state);
+
+   const bool flags[] {
+      interpreter.stringmode, interpreter.outputString, interpreter.reverseString,
+      interpreter.numbermode, interpreter.hexadecimalNumber,
+      interpreter.identifiermode, interpreter.gettingVariable, interpreter.callingFunction, interpreter.gettingLabelPos,
+      interpreter.defermode
+   };
+   append(state, flags);
+
+   appendString(state, interpreter.temporaryString);
+   appendString(state, interpreter.numberString);
+   appendString(state, interpreter.identifier);
+
+   append(state, interpreter.stack.size());
+   for (int value: interpreter.stack.c) {
+      append(state, value);
+   }
+
+   append(state, interpreter.defered.size());
+   for (const Token &token: interpreter.defered.c) {
+      append(state, token.type);
+      append(state, token.value);
+   }
+
+   append(state, interpreter.jumps.size());
+   for (const Frame &frame: interpreter.jumps.c) {
+      append(state, frame);
+   }
+}
+
+size_t LoopDetector::hash(const Interpreter &interpreter) {
+   serialize(interpreter, current.ordered);
+   uint64_t result = std::hash<std::string_view>()(current.ordered);
+
+   // Hash maps don't keep an order, so their entries are summed
+   uint64_t registers = interpreter.registers.size();
+   for (auto &[index, value]: interpreter.registers) {
+      registers += mix((static_cast<uint64_t>(static_cast<uint32_t>(index)) << 32) | static_cast<uint32_t>(value));
+   }
+
+   uint64_t variables = interpreter.variables.size();
+   for (auto &[name, value]: interpreter.variables) {
+      variables += mix(std::hash<std::string_view>()(name) ^ mix(static_cast<uint32_t>(value)));
+   }
+
+   return mix(result ^ mix(registers)) ^ mix(variables + 1);
+}
+
+bool LoopDetector::isDeterministic(const std::pmr::string &function) {
+   static const std::unordered_set<std::string_view> deterministic {
+      "abs", "sign", "min", "max", "clamp", "sclamp", "mod", "pow",
+      "rand", "randint", "randcond", "randfill", "srand",
+      "regfill", "regcopy", "regsum", "regmin", "regmax", "regfind", "regcmp", "regsort",
+      "strlen", "streq", "strfind", "strcat", "strrev", "upper", "lower", "atoi", "itoa"
+   };
+   return deterministic.contains(function);
+}
@@ -1,11 +1,25 @@
+#include "async.hpp"
 #include "format.hpp" // IWYU pragma: export
 #include "interpreter.hpp"
+#include "replay.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <charconv>
 #include <cmath>
+#include <cstdio>
 #include <ctime>
 #include <filesystem>
 #include <fstream>
 #include <thread>
 
+// Row of a log function, which goes to the interpreter's output like everything else the program prints
+template<typename... Args>
+static std::string formatRow(const char *base, Args... args) {
+   std::string row (std::snprintf(nullptr, 0, base, args...), '\0');
+   std::snprintf(row.data(), row.size() + 1, base, args...);
+   return row;
+}
+
 void Interpreter::initFunctions() {
    // Utility functions
 
@@ -82,25 +96,223 @@ void Interpreter::initFunctions() {
    // Random functions
 
    functions["rand"] = [this]() {
-      push(rand());
+      push(random.integer());
    };
    functions["randint"] = [this]() {
       assertStackSize(1, "randint");
       int max = pop();
       int min = pop();
-      int result = min + (rand() % (max - min + 1));
-      push(result);
+      push(random.range(min, max));
    };
    functions["randcond"] = [this]() {
-      push(rand() % 2);
+      push(random.condition());
+   };
+   functions["randfill"] = [this]() {
+      assertStackSize(4, "randfill");
+      int count = pop();
+      int start = pop();
+      int max = pop();
+      int min = pop();
+
+      assert(count >= 0, "'randfill': Expected a non-negative register count, got {}.", count);
+      assertRegisterRange(start, count, "randfill");
+      std::vector<int> values (count);
+
+      for (int &value: values) {
+         value = random.range(min, max);
+      }
+      putRegisters(start, values);
    };
    functions["srand"] = [this]() {
       assertStackSize(1, "srand");
       int seed = pop();
-      srand(seed);
+      random.seed(seed);
+   };
+   functions["srandt"] = [this]() {
+      auto now = []() -> int {
+         return time(nullptr);
+      };
+      random.seed((replay ? replay->integer('T', now) : now()));
+   };
+
+   // Register functions
+
+   functions["regfill"] = [this]() {
+      assertStackSize(3, "regfill");
+      int count = pop();
+      int start = pop();
+      int value = pop();
+
+      assert(count >= 0, "'regfill': Expected a non-negative register count, got {}.", count);
+      assertRegisterRange(start, count, "regfill");
+      fillRegisters(start, count, value);
+   };
+   functions["regcopy"] = [this]() {
+      assertStackSize(3, "regcopy");
+      int count = pop();
+      int destination = pop();
+      int source = pop();
+
+      assert(count >= 0, "'regcopy': Expected a non-negative register count, got {}.", count);
+      assertRegisterRange(source, count, "regcopy");
+      assertRegisterRange(destination, count, "regcopy");
+      copyRegisters(source, destination, count);
+   };
+   functions["regsum"] = [this]() {
+      assertStackSize(2, "regsum");
+      int count = pop();
+      int start = pop();
+
+      assert(count >= 0, "'regsum': Expected a non-negative register count, got {}.", count);
+      assertRegisterRange(start, count, "regsum");
+      std::vector<int> values = getRegisters(start, count);
+
+      // Unsigned so overflow wraps instead of being undefined, which also lets the loop vectorize
+      unsigned int sum = 0;
+      for (int value: values) {
+         sum += value;
+      }
+      push(sum);
+   };
+   functions["regmin"] = [this]() {
+      assertStackSize(2, "regmin");
+      int count = pop();
+      int start = pop();
+
+      assert(count > 0, "'regmin': Expected a positive register count, got {}.", count);
+      assertRegisterRange(start, count, "regmin");
+      std::vector<int> values = getRegisters(start, count);
+
+      int result = values[0];
+      for (int value: values) {
+         result = (value < result ? value : result);
+      }
+      push(result);
+   };
+   functions["regmax"] = [this]() {
+      assertStackSize(2, "regmax");
+      int count = pop();
+      int start = pop();
+
+      assert(count > 0, "'regmax': Expected a positive register count, got {}.", count);
+      assertRegisterRange(start, count, "regmax");
+      std::vector<int> values = getRegisters(start, count);
+
+      int result = values[0];
+      for (int value: values) {
+         result = (value > result ? value : result);
+      }
+      push(result);
+   };
+   functions["regfind"] = [this]() {
+      assertStackSize(3, "regfind");
+      int count = pop();
+      int start = pop();
+      int value = pop();
+
+      assert(count >= 0, "'regfind': Expected a non-negative register count, got {}.", count);
+      assertRegisterRange(start, count, "regfind");
+      std::vector<int> values = getRegisters(start, count);
+
+      auto it = std::find(values.begin(), values.end(), value);
+      push((it == values.end() ? -1 : start + (it - values.begin())));
+   };
+   functions["regcmp"] = [this]() {
+      assertStackSize(3, "regcmp");
+      int count = pop();
+      int second = pop();
+      int first = pop();
+
+      assert(count >= 0, "'regcmp': Expected a non-negative register count, got {}.", count);
+      assertRegisterRange(first, count, "regcmp");
+      assertRegisterRange(second, count, "regcmp");
+      std::vector<int> a = getRegisters(first, count);
+      std::vector<int> b = getRegisters(second, count);
+
+      auto [ait, bit] = std::mismatch(a.begin(), a.end(), b.begin());
+      push((ait == a.end() ? 0 : (*ait < *bit ? -1 : 1)));
+   };
+   functions["regsort"] = [this]() {
+      assertStackSize(2, "regsort");
+      int count = pop();
+      int start = pop();
+
+      assert(count >= 0, "'regsort': Expected a non-negative register count, got {}.", count);
+      assertRegisterRange(start, count, "regsort");
+      std::vector<int> values = getRegisters(start, count);
+      std::sort(values.begin(), values.end());
+      putRegisters(start, values);
+   };
+
+   // String functions
+
+   functions["strlen"] = [this]() {
+      auto terminator = std::find(stack.c.rbegin(), stack.c.rend(), 0);
+      push(terminator - stack.c.rbegin());
    };
-   functions["srandt"] = []() {
-      srand(time(nullptr));
+   functions["streq"] = [this]() {
+      std::string a = popString("streq");
+      std::string b = popString("streq");
+      push(a == b);
+   };
+   functions["strfind"] = [this]() {
+      std::string needle = popString("strfind");
+      std::string haystack = popString("strfind");
+
+      size_t index = haystack.find(needle);
+      push((index == std::string::npos ? -1 : static_cast<int>(index)));
+   };
+   functions["strcat"] = [this]() {
+      std::string a = popString("strcat");
+      std::string b = popString("strcat");
+      pushString(b + a);
+   };
+   functions["strrev"] = [this]() {
+      auto [begin, end] = topString("strrev");
+      std::reverse(begin, end);
+   };
+   functions["upper"] = [this]() {
+      auto [begin, end] = topString("upper");
+      std::transform(begin, end, begin, [](int c) {
+         return c - 32 * (c >= 'a' && c <= 'z');
+      });
+   };
+   functions["lower"] = [this]() {
+      auto [begin, end] = topString("lower");
+      std::transform(begin, end, begin, [](int c) {
+         return c + 32 * (c >= 'A' && c <= 'Z');
+      });
+   };
+   functions["atoi"] = [this]() {
+      std::string string = popString("atoi");
+
+      // The whole string has to be the number, trailing characters aren't ignored
+      int number = 0;
+      auto [end, error] = std::from_chars(string.data(), string.data() + string.size(), number);
+      assert(error == std::errc() && end == string.data() + string.size(), "'atoi': Cannot convert string '{}' to number.", string);
+      push(number);
+   };
+   functions["itoa"] = [this]() {
+      assertStackSize(1, "itoa");
+      pushString(std::to_string(pop()));
+   };
+
+   // Instruction pointer functions
+
+   functions["split"] = [this]() {
+      push(split());
+   };
+   functions["join"] = [this]() {
+      assertStackSize(1, "join");
+      std::unique_ptr<Interpreter> child = join(pop());
+
+      for (int value: child->stack.c) {
+         push(value);
+      }
+      push(child->stack.size());
+   };
+   functions["waitall"] = [this]() {
+      joinAll();
    };
 
    // File I/O functions
@@ -116,12 +328,20 @@ void Interpreter::initFunctions() {
          filename += pop();
       }
 
-      std::ifstream file (filename);
-      assert(file.is_open(), "'readfile': Failed to open file '{}'.", filename);
+      auto read = [&filename]() {
+         std::ifstream file (filename);
+         assert(file.is_open(), "'readfile': Failed to open file '{}'.", filename);
+
+         std::string temp, total;
+         while (std::getline(file, temp)) {
+            total += temp + '\n';
+         }
+         return total;
+      };
+      std::string total = (replay ? replay->text('F', read) : read());
 
-      std::string temp, total;
-      while (std::getline(file, temp)) {
-         total += temp + '\n';
+      if (stats) {
+         stats->bytesRead += total.size();
       }
 
       for (auto it = total.rbegin(); it != total.rend(); ++it) {
@@ -154,6 +374,9 @@ void Interpreter::initFunctions() {
       assert(file.is_open(), "'writefile': Failed to open file '{}'.", filename);
 
       file << write;
+      if (stats) {
+         stats->bytesWritten += write.size();
+      }
    };
 
    functions["appendfile"] = [this]() {
@@ -181,6 +404,73 @@ void Interpreter::initFunctions() {
       assert(file.is_open(), "'appendfile': Failed to open file '{}'.", filename);
 
       file << write;
+      if (stats) {
+         stats->bytesWritten += write.size();
+      }
+   };
+
+   functions["areadfile"] = [this]() {
+      auto request = std::make_shared<AsyncRequest>();
+      request->filename = popString("areadfile");
+      push(asyncIO().submit(request));
+   };
+
+   functions["awritefile"] = [this]() {
+      auto request = std::make_shared<AsyncRequest>();
+      request->filename = popString("awritefile");
+      request->data = popString("awritefile");
+      request->write = true;
+      push(asyncIO().submit(request));
+   };
+
+   functions["aappendfile"] = [this]() {
+      auto request = std::make_shared<AsyncRequest>();
+      request->filename = popString("aappendfile");
+      request->data = popString("aappendfile");
+      request->write = request->append = true;
+      push(asyncIO().submit(request));
+   };
+
+   functions["poll"] = [this]() {
+      assertStackSize(1, "poll");
+      push(asyncIO().poll(pop()));
+   };
+
+   functions["await"] = [this]() {
+      assertStackSize(1, "await");
+      std::shared_ptr<AsyncRequest> request = asyncIO().wait(pop());
+
+      if (!request->write) {
+         auto read = [&request]() {
+            assert(!request->failed, "'await': Failed to read file '{}'.", request->filename);
+
+            // Same contents as readfile, which ends every line including the last with a newline
+            if (!request->data.empty() && request->data.back() != '\n') {
+               request->data += '\n';
+            }
+            return request->data;
+         };
+         request->data = (replay ? replay->text('F', read) : read());
+      }
+
+      if (request->write) {
+         assert(!request->failed, "'await': Failed to write file '{}'.", request->filename);
+         if (stats) {
+            stats->bytesWritten += request->data.size();
+         }
+         return;
+      }
+
+      if (stats) {
+         stats->bytesRead += request->data.size();
+      }
+      for (auto it = request->data.rbegin(); it != request->data.rend(); ++it) {
+         push(*it);
+      }
+   };
+
+   functions["prefetch"] = [this]() {
+      prefetchFile(popString("prefetch"));
    };
 
    functions["isfile"] = [this]() {
@@ -194,7 +484,10 @@ void Interpreter::initFunctions() {
          filename += pop();
       }
 
-      push(std::filesystem::exists(filename) && std::filesystem::is_regular_file(filename));
+      auto check = [&filename]() -> int {
+         return std::filesystem::exists(filename) && std::filesystem::is_regular_file(filename);
+      };
+      push((replay ? replay->integer('B', check) : check()));
    };
 
    functions["isdirectory"] = [this]() {
@@ -208,7 +501,10 @@ void Interpreter::initFunctions() {
          filename += pop();
       }
 
-      push(std::filesystem::exists(filename) && std::filesystem::is_directory(filename));
+      auto check = [&filename]() -> int {
+         return std::filesystem::exists(filename) && std::filesystem::is_directory(filename);
+      };
+      push((replay ? replay->integer('B', check) : check()));
    };
 
    functions["createdirectory"] = [this]() {
@@ -250,11 +546,24 @@ void Interpreter::initFunctions() {
          filename += pop();
       }
 
-      assert(std::filesystem::exists(filename) && std::filesystem::is_directory(filename), "'iteratedirectory': Cannot iterate directory '{}'.", filename);
+      // Entries are separated by null characters, so a recording can store the whole listing at once
+      auto list = [&filename]() {
+         std::error_code error;
+         std::filesystem::directory_iterator it (filename, error);
+         assert(!error, "'iteratedirectory': Cannot iterate directory '{}'.", filename);
+
+         std::string listing;
+         for (; it != std::filesystem::directory_iterator(); it.increment(error)) {
+            listing += it->path().string() + '\0';
+         }
+         assert(!error, "'iteratedirectory': Cannot read directory '{}': {}.", filename, error.message());
+         return listing;
+      };
+      std::string listing = (replay ? replay->text('D', list) : list());
       push(0); // EOF
-      
-      for (const auto &file: std::filesystem::directory_iterator(filename)) {
-         std::string entryName = file.path().string();
+
+      for (size_t start = 0, end; (end = listing.find('\0', start)) != std::string::npos; start = end + 1) {
+         std::string entryName = listing.substr(start, end - start);
          for (auto it = entryName.rbegin(); it != entryName.rend(); ++it) {
             push(*it);
          }
@@ -262,6 +571,73 @@ void Interpreter::initFunctions() {
       }
    };
 
+   functions["opendir"] = [this]() {
+      std::string filename = popString("opendir");
+      Directory &directory = directories[nextDirectory];
+
+      auto open = [&filename, &directory]() -> int {
+         std::error_code error;
+         directory.iterator = std::filesystem::directory_iterator(filename, error);
+         return !error;
+      };
+      assert((replay ? replay->integer('B', open) : open()), "'opendir': Cannot iterate directory '{}'.", filename);
+      push(nextDirectory);
+      nextDirectory += 1;
+   };
+
+   functions["dirfilter"] = [this]() {
+      assertStackSize(2, "dirfilter");
+      int handle = pop();
+      int filesOnly = pop();
+      std::string extension = popString("dirfilter");
+
+      assert(directories.contains(handle), "'dirfilter': Directory handle {} is not open.", handle);
+      Directory &directory = directories[handle];
+      directory.filesOnly = filesOnly;
+      directory.extension = extension;
+   };
+
+   functions["nextentry"] = [this]() {
+      assertStackSize(1, "nextentry");
+      int handle = pop();
+
+      assert(directories.contains(handle), "'nextentry': Directory handle {} is not open.", handle);
+      Directory &directory = directories[handle];
+
+      auto next = [&directory]() -> std::string {
+         auto &it = directory.iterator;
+         while (it != std::filesystem::directory_iterator()) {
+            // Entries can disappear while the directory is open, a dangling one just isn't a regular file
+            std::error_code error;
+            std::filesystem::file_status status = it->status(error);
+            assert(!error || status.type() == std::filesystem::file_type::not_found, "'nextentry': Cannot read entry '{}': {}.", it->path().string(), error.message());
+
+            bool matches = (!directory.filesOnly || std::filesystem::is_regular_file(status)) && (directory.extension.empty() || it->path().extension() == directory.extension);
+            std::string entryName = it->path().string();
+
+            it.increment(error);
+            assert(!error, "'nextentry': Cannot read the entry after '{}': {}.", entryName, error.message());
+            if (matches) {
+               return entryName;
+            }
+         }
+         return "";
+      };
+
+      std::string entryName = (replay ? replay->text('E', next) : next());
+      if (entryName.empty()) {
+         push(0); // EOF
+      } else {
+         pushString(entryName);
+      }
+   };
+
+   functions["closedir"] = [this]() {
+      assertStackSize(1, "closedir");
+      int handle = pop();
+      assert(directories.erase(handle), "'closedir': Directory handle {} is not open.", handle);
+   };
+
    functions["deletefile"] = [this]() {
       assertStackSize(1, "deletefile");
       int charcount = pop();
@@ -279,72 +655,72 @@ void Interpreter::initFunctions() {
    // Debug functions
 
    functions["logstack"] = [this]() {
-      std::cout << "STACK (top to bottom):\n";
-      std::cout << "SIZE: " << stack.size() << "\n";
+      *output << "STACK (top to bottom):\n";
+      *output << "SIZE: " << stack.size() << "\n";
 
-      std::stack<int> stackCopy = stack;
+      Stack<int> stackCopy = stack;
       int counter = 1;
 
       while (!stack.empty()) {
          int popped = pop();
-         printf("%5d: Num: %-10d ASCII: '%c'\n", counter, popped, popped);
+         *output << formatRow("%5d: Num: %-10d ASCII: '%c'\n", counter, popped, popped);
          counter += 1;
       }
 
       stack = stackCopy;
-      std::cout << "END OF STACK\n";
+      *output << "END OF STACK\n";
    };
 
    functions["logdefer"] = [this]() {
-      std::cout << "DEFER STACK (top to bottom):\n";
-      std::cout << "SIZE: " << defered.size() << "\n";
+      *output << "DEFER STACK (top to bottom):\n";
+      *output << "SIZE: " << defered.size() << "\n";
 
-      std::stack<Token> deferedCopy = defered;
+      Stack<Token> deferedCopy = defered;
       int counter = 1;
 
       while (!defered.empty()) {
          Token popped = defered.top();
          defered.pop();
 
-         printf("%5d: ASCII: '%c' Type: '%s'\n", counter, popped.value, tokenTypeStrings[popped.type]);
+         *output << formatRow("%5d: ASCII: '%c' Type: '%s'\n", counter, popped.value, tokenTypeStrings[popped.type]);
          counter += 1;
       }
 
       defered = deferedCopy;
-      std::cout << "END OF DEFER STACK\n";
+      *output << "END OF DEFER STACK\n";
    };
 
    functions["logregs"] = [this]() {
-      std::cout << "REGISTERS:\n";
-      std::cout << "SIZE: " << registers.size() << '\n';
+      *output << "REGISTERS:\n";
+      *output << "SIZE: " << registers.size() << '\n';
       
       for (auto &[index, value]: registers) {
-         printf("%5d: %d\n", index, value);
+         *output << formatRow("%5d: %d\n", index, value);
       }
-      std::cout << "END OF REGISTERS\n";
+      *output << "END OF REGISTERS\n";
    };
 
    functions["logvars"] = [this]() {
-      std::cout << "VARIABLES:\n";
-      std::cout << "SIZE: " << variables.size() << '\n';
+      *output << "VARIABLES:\n";
+      *output << "SIZE: " << variables.size() << '\n';
       int counter = 1;
 
       for (auto &[identifier, value]: variables) {
-         printf("%5d: '%s': Num: %-10d ASCII: '%c'\n", counter, identifier.c_str(), value, value);
+         *output << formatRow("%5d: '%s': Num: %-10d ASCII: '%c'\n", counter, identifier.c_str(), value, value);
          counter += 1;
       }
-      std::cout << "END OF VARIABLES\n";
+      *output << "END OF VARIABLES\n";
    };
 
    functions["loglabels"] = [this]() {
-      std::cout << "LABELS:\n";
-      std::cout << "SIZE: " << labels.size() << '\n';
+      *output << "LABELS:\n";
+      *output << "SIZE: " << labels.size() << '\n';
       int counter = 1;
 
       for (auto &[label, position]: labels) {
-         printf("%5d: '%s': X: %d Y: %d\n", counter, label.c_str(), position.x, position.y);
+         *output << formatRow("%5d: '%s': X: %d Y: %d\n", counter, label.c_str(), position.x, position.y);
          counter += 1;
       }
-      std::cout << "END OF LABELS\n";
+      *output << "END OF LABELS\n";
    };
 }
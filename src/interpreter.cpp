@@ -1,5 +1,15 @@
+#include "async.hpp"
+#include "detector.hpp"
 #include "format.hpp" // IWYU pragma: export
 #include "interpreter.hpp"
+#include "profile.hpp"
+#include "scheduler.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <climits>
+#include <random>
+#include <utility>
 
 // Vector2
 
@@ -13,20 +23,31 @@ size_t Vector2::operator()(const Vector2 &vector) const {
 
 // Constructor
 
-Interpreter::Interpreter() {
-   srand(time(nullptr));
+Interpreter::Interpreter(std::pmr::memory_resource *resource)
+   : resource(resource), commands(resource), functions(resource), labels(resource), constants(resource), literals(resource), loops(resource), memos(resource),
+     map(resource), registers(resource), variables(resource), directories(resource), children(resource),
+     jumps(resource), memoCalls(resource), defered(resource), stack(resource),
+     input(resource), temporaryString(resource), numberString(resource), identifier(resource) {
+   random.seed(std::random_device()());
    direction = {1, 0};
    initCommands();
    initFunctions();
 }
 
+Interpreter::~Interpreter() {
+   // IPs still running, like the ones of a failed IP or session, work on objects destroyed along with this one
+   for (auto &[handle, child]: children) {
+      Scheduler::instance().wait(*child->job);
+   }
+}
+
 // Lexer
 
 void Interpreter::lex(const std::string &code) {
    Vector2 lexPosition;
 
    bool isLexingLabel = false;
-   std::string label;
+   std::pmr::string label (resource);
 
    for (size_t i = 0; i < code.size(); ++i) {
       char character = code[i];
@@ -51,6 +72,10 @@ void Interpreter::lex(const std::string &code) {
       }
       lexPosition.x += 1;
    }
+   lexLiterals();
+   analyzeLoops();
+   analyzeJumps();
+   analyzeMemos();
 }
 
 Token Interpreter::lexCommand(char character) {
@@ -63,13 +88,98 @@ Token Interpreter::lexCommand(char character) {
    }
 }
 
+void Interpreter::lexLiterals() {
+   // The playfield never changes, so a string along a straight path can be extracted once and pushed in bulk
+   Vector2 size;
+   for (auto &[cell, token]: map) {
+      size.x = std::max(size.x, cell.x + 1);
+      size.y = std::max(size.y, cell.y + 1);
+   }
+
+   const Vector2 directions[] {{1, 0}, {-1, 0}, {0, -1}, {0, 1}};
+   for (auto &[cell, token]: map) {
+      if (token.type != Token::stringmode) {
+         continue;
+      }
+
+      std::array<int, 4> &literal = literals[cell];
+      for (const Vector2 &step: directions) {
+         int &constant = literal[directionIndex(step)];
+         constant = -1;
+
+         std::pmr::string value (resource);
+         Vector2 current = {cell.x + step.x, cell.y + step.y};
+
+         while (current.x >= 0 && current.y >= 0 && current.x < size.x && current.y < size.y) {
+            Token command = tokenAt(current);
+            if (command.type == Token::stringmode) {
+               constant = constants.size();
+               constants.push_back(value);
+               break;
+            }
+
+            value += command.value;
+            current = {current.x + step.x, current.y + step.y};
+         }
+      }
+   }
+}
+
 // Interpreter
 
 void Interpreter::run(const std::string &code) {
+   if (stats) {
+      stats->beginLex();
+   }
    lex(code);
 
-   while (true) {
-      runCommand(map[position]);
+   if (stats) {
+      stats->beginRun();
+   }
+   execute();
+}
+
+void Interpreter::execute() {
+   while (!terminated) {
+      step();
+   }
+}
+
+void Interpreter::step() {
+   Token command = tokenAt(position);
+   waitingForInput = false;
+
+   // A cell that waited for input runs again once the session is fed, but was already counted the first time
+   if (resuming) {
+      resuming = false;
+   } else {
+      if (trace) {
+         trace->record(position.x, position.y, direction.x, direction.y, command.value, top());
+      }
+
+      if (stats) {
+         stats->step();
+      }
+
+      if (profiler && Profiler::pending) {
+         profiler->sample(*this);
+      }
+
+      if (detector) {
+         detector->step(*this);
+      }
+   }
+
+   if (command.type == Token::stringmode && !stringmode && !identifiermode && !numbermode && !defermode && runLiteral()) {
+      // Skipped to the cell before the closing '"'
+   } else if (command.accelerated && !stringmode && !identifiermode && !numbermode && !defermode && accelerateLoop()) {
+      // Skipped all but the last iteration of the loop
+   } else {
+      runCommand(command);
+   }
+
+   // An input command without input stays on its cell until the session is fed
+   if (!waitingForInput) {
       forward();
    }
 }
@@ -82,17 +192,29 @@ void Interpreter::runCommand(Token command) {
          push(variables[identifier]);
       } else if (callingFunction) {
          assert(functions.contains(identifier), "Built-in function '{}' is not defined.", identifier);
+         if (stats) {
+            stats->functionCalls[std::string(identifier)] += 1;
+         }
+         if (detector && !LoopDetector::isDeterministic(identifier)) {
+            interactions += 1;
+         }
          functions[identifier]();
       } else if (gettingLabelPos) {
          assert(labels.contains(identifier), "Label '{}' is not defined.", identifier);
 
-         jumps.push(direction);
-         jumps.push(position);
-         
-         Vector2 &newPosition = labels[identifier];
-         position = newPosition;
-         direction = {1, 0};
-         back();
+         if (recallMemo(command)) {
+            // The label already ran with these inputs, its results took their place
+         } else {
+            // Calls to labels that never return, and calls right before an 'R', reuse the caller's frame
+            if (!(command.frameless & (1 << directionIndex(direction)))) {
+               jumps.push({position, direction});
+            }
+
+            Vector2 &newPosition = labels[identifier];
+            position = newPosition;
+            direction = {1, 0};
+            back();
+         }
       } else {
          // Stack size checked in Token::define command
          int a = pop();
@@ -115,7 +237,7 @@ void Interpreter::runCommand(Token command) {
       numbermode = false;
       if (!numberString.empty()) {
          try {
-            push(std::stoi(numberString, nullptr, (hexadecimalNumber ? 16 : 10)));
+            push(std::stoi(std::string(numberString), nullptr, (hexadecimalNumber ? 16 : 10)));
             numberString.clear();
          } catch (...) {
             raise("''': Cannot convert string '{}' to number. Number is too large.", numberString);
@@ -131,7 +253,8 @@ void Interpreter::runCommand(Token command) {
       if (reverseString) {
          temporaryString.push_back(command.value);
       } else if (outputString) {
-         std::cout << command.value;
+         *output << command.value;
+         interactions += 1;
       } else {
          push(command.value);
       }
@@ -140,6 +263,8 @@ void Interpreter::runCommand(Token command) {
 
    // Handle defer mode
    if (defermode && command.type != Token::defer) {
+      // Deferred commands run at the 'X' cell, so what was worked out for their own cell doesn't apply
+      command.frameless = 0;
       defered.push(command);
       return;
    }
@@ -149,6 +274,110 @@ void Interpreter::runCommand(Token command) {
    commands[command.type](command.value);
 }
 
+bool Interpreter::runLiteral() {
+   auto it = literals.find(position);
+   if (it == literals.end()) {
+      return false;
+   }
+
+   int constant = it->second[directionIndex(direction)];
+   if (constant < 0) {
+      return false;
+   }
+
+   const std::pmr::string &value = constants[constant];
+   stringmode = true;
+
+   if (reverseString) {
+      temporaryString += value;
+   } else if (outputString) {
+      output->write(value.data(), value.size());
+      interactions += 1;
+   } else {
+      stack.c.insert(stack.c.end(), value.begin(), value.end());
+   }
+
+   position.x += direction.x * static_cast<int>(value.size());
+   position.y += direction.y * static_cast<int>(value.size());
+
+   // Steps still count every cell, as if the literal had been run one character at a time
+   if (stats) {
+      stats->steps += value.size();
+   }
+   return true;
+}
+
+// Instruction pointers
+
+int Interpreter::split() {
+   // The new IP starts on the current cell with copies of the playfield, stack and storage. Nothing
+   // mutable is shared, so the single-IP path needs no locking; results come back through 'join'.
+   auto child = std::make_unique<Interpreter>();
+   child->ownsProcess = false;
+   child->output = output;
+
+   child->labels = labels;
+   child->constants = constants;
+   child->literals = literals;
+   child->loops = loops;
+   child->memos = memos;
+   child->map = map;
+   child->registers = registers;
+   child->variables = variables;
+   child->jumps = jumps;
+   child->defered = defered;
+   child->stack = stack;
+   child->stack.push(0);
+
+   child->position = position;
+   child->direction = direction;
+   child->random.seed(random.next());
+
+   child->stringmode = stringmode;
+   child->outputString = outputString;
+   child->reverseString = reverseString;
+   child->numbermode = numbermode;
+   child->hexadecimalNumber = hexadecimalNumber;
+   child->defermode = defermode;
+
+   Interpreter *ip = child.get();
+   child->job = Scheduler::instance().submit([ip]() {
+      ip->runChild();
+   });
+
+   children[nextChild] = std::move(child);
+   return nextChild++;
+}
+
+std::unique_ptr<Interpreter> Interpreter::join(int handle) {
+   auto it = children.find(handle);
+   assert(it != children.end(), "'join': Instruction pointer {} does not exist or was already joined.", handle);
+
+   std::unique_ptr<Interpreter> child = std::move(it->second);
+   children.erase(it);
+
+   Scheduler::instance().wait(*child->job);
+   assert(child->failure.empty(), "'join': Instruction pointer {} failed: {}", handle, child->failure);
+   return child;
+}
+
+void Interpreter::joinAll() {
+   while (!children.empty()) {
+      join(children.begin()->first);
+   }
+}
+
+void Interpreter::runChild() {
+   // Errors end only this IP, the one joining it reports them
+   bool throws = std::exchange(raiseThrows, true);
+   try {
+      execute();
+   } catch (const std::exception &error) {
+      failure = error.what();
+   }
+   raiseThrows = throws;
+}
+
 // Utility functions
 
 void Interpreter::forward() {
@@ -161,6 +390,15 @@ void Interpreter::back() {
    position.y -= direction.y;
 }
 
+Token Interpreter::tokenAt(Vector2 cell) const {
+   auto it = map.find(cell);
+   return (it == map.end() ? Token{} : it->second);
+}
+
+int Interpreter::directionIndex(Vector2 vector) const {
+   return (vector.x == 1 ? 0 : (vector.x == -1 ? 1 : (vector.y == -1 ? 2 : 3)));
+}
+
 int Interpreter::pop() {
    if (stack.empty()) {
       return 0;
@@ -182,6 +420,90 @@ void Interpreter::push(int value) {
    stack.push(value);
 }
 
+std::string Interpreter::popString(const std::string &function) {
+   assertStackSize(1, function);
+   int charcount = pop();
+
+   assertStackSize(charcount, function);
+   std::string string;
+
+   for (int i = 0; i < charcount; ++i) {
+      string += pop();
+   }
+   return string;
+}
+
+void Interpreter::pushString(const std::string &string) {
+   for (auto it = string.rbegin(); it != string.rend(); ++it) {
+      push(*it);
+   }
+   push(string.size());
+}
+
+std::pair<std::pmr::deque<int>::iterator, std::pmr::deque<int>::iterator> Interpreter::topString(const std::string &function) {
+   assertStackSize(1, function);
+   int charcount = top();
+
+   assert(charcount >= 0, "Function '{}': Expected a non-negative string length, got {}.", function, charcount);
+   assertStackSize(charcount + 1, function);
+   return {stack.c.end() - 1 - charcount, stack.c.end() - 1};
+}
+
+std::vector<int> Interpreter::getRegisters(int start, int count) {
+   std::vector<int> values (count, 0);
+
+   for (int i = 0; i < count; ++i) {
+      auto it = registers.find(static_cast<int>(static_cast<int64_t>(start) + i));
+      if (it != registers.end()) {
+         values[i] = it->second;
+      }
+   }
+   return values;
+}
+
+void Interpreter::putRegisters(int start, const std::vector<int> &values) {
+   registers.reserve(registers.size() + values.size());
+   for (size_t i = 0; i < values.size(); ++i) {
+      registers[static_cast<int>(start + static_cast<int64_t>(i))] = values[i];
+   }
+}
+
+void Interpreter::fillRegisters(int start, int count, int value) {
+   registers.reserve(registers.size() + count);
+   for (int64_t index = start; index < static_cast<int64_t>(start) + count; ++index) {
+      registers[static_cast<int>(index)] = value;
+   }
+}
+
+void Interpreter::copyRegisters(int source, int destination, int count) {
+   auto copy = [&](int64_t i) {
+      auto it = registers.find(static_cast<int>(source + i));
+      registers[static_cast<int>(destination + i)] = (it == registers.end() ? 0 : it->second);
+   };
+
+   // Like memmove, copy from the end when the destination overlaps the end of the source
+   if (destination > source) {
+      for (int64_t i = count - 1; i >= 0; --i) {
+         copy(i);
+      }
+   } else {
+      for (int64_t i = 0; i < count; ++i) {
+         copy(i);
+      }
+   }
+}
+
+void Interpreter::assertRegisterRange(int start, int count, const std::string &function) {
+   assert(static_cast<int64_t>(start) + count - 1 <= INT_MAX, "'{}': The range of {} registers starting at {} goes past the last register.", function, count, start);
+}
+
+AsyncIO &Interpreter::asyncIO() {
+   if (!async) {
+      async = std::make_unique<AsyncIO>();
+   }
+   return *async;
+}
+
 void Interpreter::assertStackSize(size_t minimum, char operatorc) {
    assert(stack.size() >= minimum, "'{}': Expected stack size to be at least {}, but it is {} instead.", operatorc, minimum, stack.size());
 }
@@ -0,0 +1,506 @@
+#include "format.hpp" // IWYU pragma: export
+#include "interpreter.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <climits>
+#include <utility>
+
+using Affine = CountingLoop::Affine;
+using Matrix = std::pmr::vector<std::pmr::vector<uint32_t>>;
+
+// Wide enough to evaluate an expression of int coefficients and inputs without overflowing
+__extension__ using Wide = __int128;
+
+// Counting loop
+
+Affine::Affine(allocator_type allocator): coefficients(allocator) {}
+
+Affine::Affine(const Affine &affine, allocator_type allocator): coefficients(affine.coefficients, allocator), constant(affine.constant) {}
+
+Affine::Affine(Affine &&affine, allocator_type allocator): coefficients(std::move(affine.coefficients), allocator), constant(affine.constant) {}
+
+CountingLoop::CountingLoop(allocator_type allocator)
+   : inputs(allocator), variables(allocator), transition(allocator), operands(allocator), signs(allocator) {}
+
+CountingLoop::CountingLoop(const CountingLoop &loop, allocator_type allocator)
+   : direction(loop.direction), continueOnNonzero(loop.continueOnNonzero), usesNumbers(loop.usesNumbers), depth(loop.depth), length(loop.length),
+     inputs(loop.inputs, allocator), variables(loop.variables, allocator), transition(loop.transition, allocator),
+     operands(loop.operands, allocator), signs(loop.signs, allocator), offset(loop.offset), positive(loop.positive) {}
+
+CountingLoop::CountingLoop(CountingLoop &&loop, allocator_type allocator)
+   : direction(loop.direction), continueOnNonzero(loop.continueOnNonzero), usesNumbers(loop.usesNumbers), depth(loop.depth), length(loop.length),
+     inputs(std::move(loop.inputs), allocator), variables(std::move(loop.variables), allocator), transition(std::move(loop.transition), allocator),
+     operands(std::move(loop.operands), allocator), signs(std::move(loop.signs), allocator), offset(loop.offset), positive(loop.positive) {}
+
+// Symbolic value while walking a loop body. Comparisons can only be consumed by the loop's own test.
+
+struct Symbol {
+   enum Kind { affine, greater, equals, negation };
+
+   Kind kind = affine;
+   Affine a, b;
+};
+
+static Affine constant(uint32_t value) {
+   Affine result;
+   result.constant = value;
+   return result;
+}
+
+static bool isConstant(const Affine &value) {
+   return std::all_of(value.coefficients.begin(), value.coefficients.end(), [](uint32_t c) {
+      return c == 0;
+   });
+}
+
+static Affine combine(const Affine &a, const Affine &b, uint32_t scaleA, uint32_t scaleB) {
+   Affine result;
+   result.coefficients.resize(std::max(a.coefficients.size(), b.coefficients.size()), 0);
+
+   for (size_t i = 0; i < result.coefficients.size(); ++i) {
+      uint32_t ca = (i < a.coefficients.size() ? a.coefficients[i] : 0);
+      uint32_t cb = (i < b.coefficients.size() ? b.coefficients[i] : 0);
+      result.coefficients[i] = ca * scaleA + cb * scaleB;
+   }
+   result.constant = a.constant * scaleA + b.constant * scaleB;
+   return result;
+}
+
+static Affine scale(const Affine &a, uint32_t factor) {
+   return combine(a, Affine{}, factor, 0);
+}
+
+static Matrix multiply(const Matrix &a, const Matrix &b) {
+   size_t size = a.size();
+   Matrix result (size, std::pmr::vector<uint32_t>(size, 0));
+
+   for (size_t i = 0; i < size; ++i) {
+      for (size_t k = 0; k < size; ++k) {
+         if (a[i][k] == 0) {
+            continue;
+         }
+         for (size_t j = 0; j < size; ++j) {
+            result[i][j] += a[i][k] * b[k][j];
+         }
+      }
+   }
+   return result;
+}
+
+static Matrix power(Matrix base, uint64_t exponent) {
+   size_t size = base.size();
+   Matrix result (size, std::pmr::vector<uint32_t>(size, 0));
+   for (size_t i = 0; i < size; ++i) {
+      result[i][i] = 1;
+   }
+
+   while (exponent) {
+      if (exponent & 1) {
+         result = multiply(result, base);
+      }
+      base = multiply(base, base);
+      exponent >>= 1;
+   }
+   return result;
+}
+
+// Exact value of an affine expression, coefficients are read as signed like the interpreter's ints
+static Wide evaluate(const Affine &value, const std::vector<uint32_t> &inputs) {
+   Wide result = static_cast<int32_t>(value.constant);
+   for (size_t i = 0; i < value.coefficients.size(); ++i) {
+      result += static_cast<Wide>(static_cast<int32_t>(value.coefficients[i])) * static_cast<int32_t>(inputs[i]);
+   }
+   return result;
+}
+
+// Analysis
+
+void Interpreter::analyzeLoops() {
+   const Vector2 directions[] {{1, 0}, {-1, 0}, {0, -1}, {0, 1}};
+
+   for (auto &[cell, token]: map) {
+      Vector2 turn;
+      switch (token.type) {
+         case Token::rightCondition: turn = {1, 0}; break;
+         case Token::leftCondition: turn = {-1, 0}; break;
+         case Token::upCondition: turn = {0, -1}; break;
+         case Token::downCondition: turn = {0, 1}; break;
+         default: continue;
+      }
+
+      std::pmr::vector<CountingLoop> found (resource);
+      CountingLoop loop (resource);
+
+      if (analyzeLoop(cell, turn, true, loop)) {
+         found.push_back(loop);
+      }
+      for (const Vector2 &direction: directions) {
+         loop = CountingLoop(resource);
+         if (!(direction == turn) && analyzeLoop(cell, direction, false, loop)) {
+            found.push_back(loop);
+         }
+      }
+
+      if (!found.empty()) {
+         token.accelerated = true;
+         loops[cell] = std::move(found);
+      }
+   }
+}
+
+bool Interpreter::analyzeLoop(Vector2 cell, Vector2 direction, bool continueOnNonzero, CountingLoop &loop) const {
+   constexpr int maximumSteps = 4096;
+   constexpr size_t maximumInputs = 16;
+
+   loop.direction = direction;
+   loop.continueOnNonzero = continueOnNonzero;
+
+   std::vector<Symbol> stack;
+   std::unordered_map<std::string, Affine> values;
+
+   auto input = [&loop](int id) {
+      loop.inputs.push_back(id);
+      Affine result;
+      result.coefficients.assign(loop.inputs.size(), 0);
+      result.coefficients.back() = 1;
+      return result;
+   };
+   auto pop = [&]() {
+      if (stack.empty()) {
+         return Symbol{Symbol::affine, input(loop.depth++), {}};
+      }
+      Symbol symbol = stack.back();
+      stack.pop_back();
+      return symbol;
+   };
+   auto variable = [&](const std::string &name) -> Affine & {
+      if (!values.contains(name)) {
+         loop.variables.emplace_back(name);
+         values[name] = input(-static_cast<int>(loop.variables.size()));
+      }
+      return values[name];
+   };
+
+   // Walk the body once, from just after the conditional cell until the PC arrives on it again
+   Vector2 position = cell;
+   bool arrived = false;
+
+   for (int steps = 0; steps < maximumSteps && !arrived && loop.inputs.size() <= maximumInputs; ++steps) {
+      position = {position.x + direction.x, position.y + direction.y};
+      if (position == cell) {
+         arrived = true;
+         break;
+      }
+      loop.length += 1;
+      Token command = tokenAt(position);
+
+      // Identifiers and numbers span several cells, the cell ending them runs as a normal command and may start another
+      while (command.type == Token::define || command.type == Token::getVariable || command.type == Token::numbermode) {
+         bool identifier = (command.type != Token::numbermode);
+         bool defining = (command.type == Token::define);
+         std::string text;
+
+         while (true) {
+            position = {position.x + direction.x, position.y + direction.y};
+            command = tokenAt(position);
+            loop.length += 1;
+            if (position == cell || (!identifier && command.value == 'X' && text.empty())) {
+               return false;
+            }
+            if (identifier ? (!std::isalnum(command.value) && command.value != '_') : command.type != Token::number) {
+               break;
+            }
+            text += command.value;
+         }
+
+         if (!identifier) {
+            loop.usesNumbers = true;
+            if (text.size() > 9) {
+               return false;
+            }
+            if (!text.empty()) {
+               stack.push_back({Symbol::affine, constant(std::stoi(text)), {}});
+            }
+         } else if (text.empty()) {
+            return false;
+         } else if (defining) {
+            Symbol value = pop();
+            if (value.kind != Symbol::affine) {
+               return false;
+            }
+            variable(text);
+            values[text] = value.a;
+         } else {
+            stack.push_back({Symbol::affine, variable(text), {}});
+         }
+      }
+
+      switch (command.type) {
+         case Token::empty:
+            break;
+         case Token::right: direction = {1, 0}; break;
+         case Token::left: direction = {-1, 0}; break;
+         case Token::up: direction = {0, -1}; break;
+         case Token::down: direction = {0, 1}; break;
+         case Token::bridge:
+            position = {position.x + direction.x, position.y + direction.y};
+            break;
+
+         case Token::number:
+            stack.push_back({Symbol::affine, constant(command.value - '0'), {}});
+            break;
+         case Token::ten:
+            stack.push_back({Symbol::affine, constant(10), {}});
+            break;
+
+         case Token::add:
+         case Token::subtract:
+         case Token::multiply:
+         case Token::greaterThan:
+         case Token::equals: {
+            Symbol a = pop();
+            Symbol b = pop();
+            if (a.kind != Symbol::affine || b.kind != Symbol::affine) {
+               return false;
+            }
+
+            if (command.type == Token::add) {
+               stack.push_back({Symbol::affine, combine(b.a, a.a, 1, 1), {}});
+            } else if (command.type == Token::subtract) {
+               stack.push_back({Symbol::affine, combine(b.a, a.a, 1, -1u), {}});
+            } else if (command.type == Token::multiply) {
+               // Only products with a constant stay affine
+               if (isConstant(a.a)) {
+                  stack.push_back({Symbol::affine, scale(b.a, a.a.constant), {}});
+               } else if (isConstant(b.a)) {
+                  stack.push_back({Symbol::affine, scale(a.a, b.a.constant), {}});
+               } else {
+                  return false;
+               }
+            } else {
+               stack.push_back({(command.type == Token::greaterThan ? Symbol::greater : Symbol::equals), a.a, b.a});
+            }
+            break;
+         }
+         case Token::increment:
+         case Token::decrement:
+         case Token::negate:
+         case Token::logical_not: {
+            Symbol a = pop();
+            if (a.kind != Symbol::affine) {
+               return false;
+            }
+
+            if (command.type == Token::increment) {
+               stack.push_back({Symbol::affine, combine(a.a, constant(1), 1, 1), {}});
+            } else if (command.type == Token::decrement) {
+               stack.push_back({Symbol::affine, combine(a.a, constant(1), 1, -1u), {}});
+            } else if (command.type == Token::negate) {
+               stack.push_back({Symbol::affine, scale(a.a, -1u), {}});
+            } else {
+               stack.push_back({Symbol::negation, a.a, {}});
+            }
+            break;
+         }
+
+         case Token::duplicate: {
+            Symbol a = pop();
+            stack.push_back(a);
+            stack.push_back(a);
+            break;
+         }
+         case Token::swap: {
+            Symbol a = pop();
+            Symbol b = pop();
+            stack.push_back(a);
+            stack.push_back(b);
+            break;
+         }
+         case Token::pop:
+            pop();
+            break;
+
+         default:
+            // I/O, identifiers with side effects, other conditionals and mode changes end the analysis
+            return false;
+      }
+   }
+
+   if (!arrived || loop.inputs.size() > maximumInputs) {
+      return false;
+   }
+   if (!continueOnNonzero && !(direction == loop.direction)) {
+      return false;
+   }
+
+   // The body has to leave the stack as deep as it found it, with the next tested value on top
+   if (stack.size() != static_cast<size_t>(loop.depth) + 1) {
+      return false;
+   }
+   for (size_t i = 0; i + 1 < stack.size(); ++i) {
+      if (stack[i].kind != Symbol::affine) {
+         return false;
+      }
+   }
+
+   size_t size = loop.inputs.size() + 1;
+   loop.transition.assign(size, std::pmr::vector<uint32_t>(size, 0));
+   loop.transition[size - 1][size - 1] = 1;
+
+   for (size_t i = 0; i < loop.inputs.size(); ++i) {
+      int id = loop.inputs[i];
+      const Affine &value = (id >= 0 ? stack[loop.depth - 1 - id].a : values[std::string(loop.variables[-1 - id])]);
+
+      for (size_t j = 0; j < value.coefficients.size(); ++j) {
+         loop.transition[i][j] = value.coefficients[j];
+      }
+      loop.transition[i][size - 1] = value.constant;
+   }
+
+   const Symbol &test = stack.back();
+   if (continueOnNonzero && test.kind == Symbol::affine) {
+      loop.operands = {test.a};
+      loop.signs = {1};
+   } else if (continueOnNonzero && test.kind == Symbol::greater) {
+      // 'G' pushes B > A, so keep going while B - A is positive
+      loop.operands = {test.a, test.b};
+      loop.signs = {-1, 1};
+      loop.positive = true;
+   } else if (!continueOnNonzero && test.kind == Symbol::greater) {
+      loop.operands = {test.a, test.b};
+      loop.signs = {1, -1};
+      loop.offset = 1;
+      loop.positive = true;
+   } else if (!continueOnNonzero && test.kind == Symbol::equals) {
+      loop.operands = {test.a, test.b};
+      loop.signs = {1, -1};
+   } else if (!continueOnNonzero && test.kind == Symbol::negation) {
+      loop.operands = {test.a};
+      loop.signs = {1};
+   } else {
+      return false;
+   }
+
+   // Every operand has to change by a constant each iteration, then the trip count has a closed form
+   for (Affine &operand: loop.operands) {
+      operand.coefficients.resize(loop.inputs.size(), 0);
+
+      for (size_t j = 0; j < loop.inputs.size(); ++j) {
+         uint32_t next = 0;
+         for (size_t i = 0; i < loop.inputs.size(); ++i) {
+            next += operand.coefficients[i] * loop.transition[i][j];
+         }
+         if (next != operand.coefficients[j]) {
+            return false;
+         }
+      }
+   }
+   return true;
+}
+
+// Runtime
+
+bool Interpreter::accelerateLoop() {
+   auto it = loops.find(position);
+   if (it == loops.end() || stack.empty()) {
+      return false;
+   }
+   bool tested = top() != 0;
+
+   for (const CountingLoop &loop: it->second) {
+      if (loop.continueOnNonzero != tested || (!loop.continueOnNonzero && !(loop.direction == direction))) {
+         continue;
+      }
+      if (stack.size() < static_cast<size_t>(loop.depth) + 1 || (loop.usesNumbers && hexadecimalNumber)) {
+         return false;
+      }
+
+      // Current inputs, as they will be once the conditional pops the tested value
+      size_t size = loop.inputs.size() + 1;
+      std::vector<uint32_t> inputs (size, 1);
+
+      for (size_t i = 0; i < loop.inputs.size(); ++i) {
+         int id = loop.inputs[i];
+         if (id >= 0) {
+            inputs[i] = stack.c[stack.c.size() - 2 - id];
+            continue;
+         }
+
+         auto variable = variables.find(loop.variables[-1 - id]);
+         if (variable == variables.end()) {
+            return false;
+         }
+         inputs[i] = variable->second;
+      }
+
+      // Operand k is operand(0) + m * step(k) after m more iterations
+      Wide counter = loop.offset, step = 0;
+      std::vector<Wide> operands, steps;
+
+      for (size_t k = 0; k < loop.operands.size(); ++k) {
+         const Affine &operand = loop.operands[k];
+         uint32_t delta = 0;
+         for (size_t i = 0; i < loop.inputs.size(); ++i) {
+            delta += operand.coefficients[i] * loop.transition[i][size - 1];
+         }
+
+         operands.push_back(evaluate(operand, inputs));
+         steps.push_back(static_cast<int32_t>(delta));
+         counter += loop.signs[k] * operands.back();
+         step += loop.signs[k] * steps.back();
+      }
+
+      // Iterations whose test still passes, the last one runs normally so the exit takes the usual path
+      Wide skip = 0;
+      if (loop.positive) {
+         if (counter <= 0) {
+            return false;
+         }
+         if (step >= 0) {
+            return false;
+         }
+         skip = (counter + (-step) - 1) / (-step);
+      } else {
+         if (counter == 0 || step == 0 || counter % step != 0 || -counter / step < 0) {
+            return false;
+         }
+         skip = -counter / step;
+      }
+
+      if (skip <= 0 || skip > INT_MAX) {
+         return false;
+      }
+      for (size_t k = 0; k < operands.size(); ++k) {
+         for (Wide value: {operands[k], operands[k] + skip * steps[k]}) {
+            if (value < INT_MIN || value > INT_MAX) {
+               return false;
+            }
+         }
+      }
+
+      Matrix transition = power(loop.transition, static_cast<uint64_t>(skip));
+      std::vector<uint32_t> result (size, 0);
+      for (size_t i = 0; i < size; ++i) {
+         for (size_t j = 0; j < size; ++j) {
+            result[i] += transition[i][j] * inputs[j];
+         }
+      }
+
+      pop();
+      for (size_t i = 0; i < loop.inputs.size(); ++i) {
+         int id = loop.inputs[i];
+         if (id >= 0) {
+            stack.c[stack.c.size() - 1 - id] = result[i];
+         } else {
+            variables[loop.variables[-1 - id]] = result[i];
+         }
+      }
+      direction = loop.direction;
+
+      if (stats) {
+         stats->steps += static_cast<uint64_t>(skip) * loop.length;
+      }
+      return true;
+   }
+   return false;
+}
@@ -1,16 +1,203 @@
+#include "detector.hpp"
 #include "file.hpp"
 #include "format.hpp" // IWYU pragma: export
 #include "interpreter.hpp"
+#include "profile.hpp"
+#include "replay.hpp"
+#include "server.hpp"
+#include "session.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include <cstdlib>
+#include <memory>
+#include <memory_resource>
+#include <random>
+#include <unistd.h>
+#include <vector>
 
 int main(int argc, char *argv[]) {
-   assert(argc == 2, "Expected 2 arguments, got {} instead. See '-h' for more info.", argc);
-   std::string input = argv[1];
+   std::string input, traceFile, profileFile, recordFile, replayFile, socketPath;
+   std::vector<std::string> programs;
+   bool seeded = false, collectStats = false, statsJson = false, useArena = false, useSession = false, detectLoops = false;
+   uint64_t seed = 0;
+   size_t arenaSize = 0;
+   uint64_t detectInterval = 1024;
+   int workers = 4;
+   unsigned timeout = 30;
+
+   for (int i = 1; i < argc; ++i) {
+      std::string argument = argv[i];
+
+      if (argument == "--seed") {
+         assert(i + 1 < argc, "Option '--seed' expects a value.");
+         try {
+            seed = std::stoull(argv[++i]);
+            seeded = true;
+         } catch (...) {
+            raise("Option '--seed': Cannot convert '{}' to a seed.", argv[i]);
+         }
+      } else if (argument == "--stats" || argument == "--stats=text" || argument == "--stats=json") {
+         collectStats = true;
+         statsJson = (argument == "--stats=json");
+      } else if (argument == "--arena" || argument.starts_with("--arena=")) {
+         useArena = true;
+         if (argument != "--arena") {
+            try {
+               arenaSize = std::stoull(argument.substr(8));
+            } catch (...) {
+               raise("Option '--arena': Cannot convert '{}' to a size.", argument.substr(8));
+            }
+         }
+      } else if (argument == "--session") {
+         useSession = true;
+      } else if (argument == "--serve") {
+         assert(i + 1 < argc, "Option '--serve' expects a socket path.");
+         socketPath = argv[++i];
+      } else if (argument == "--workers") {
+         assert(i + 1 < argc, "Option '--workers' expects a value.");
+         try {
+            workers = std::stoi(argv[++i]);
+         } catch (...) {
+            raise("Option '--workers': Cannot convert '{}' to a number.", argv[i]);
+         }
+         assert(workers > 0, "Option '--workers' expects at least 1 worker.");
+      } else if (argument == "--timeout") {
+         assert(i + 1 < argc, "Option '--timeout' expects a value.");
+         try {
+            timeout = std::stoul(argv[++i]);
+         } catch (...) {
+            raise("Option '--timeout': Cannot convert '{}' to a number of seconds.", argv[i]);
+         }
+      } else if (argument == "--detect-loops" || argument.starts_with("--detect-loops=")) {
+         detectLoops = true;
+         if (argument != "--detect-loops") {
+            try {
+               detectInterval = std::stoull(argument.substr(15));
+            } catch (...) {
+               raise("Option '--detect-loops': Cannot convert '{}' to a number of steps.", argument.substr(15));
+            }
+            assert(detectInterval > 0, "Option '--detect-loops' expects at least 1 step.");
+         }
+      } else if (argument == "--record") {
+         assert(i + 1 < argc, "Option '--record' expects a file name.");
+         recordFile = argv[++i];
+      } else if (argument == "--replay") {
+         assert(i + 1 < argc, "Option '--replay' expects a file name.");
+         replayFile = argv[++i];
+      } else if (argument == "--trace") {
+         assert(i + 1 < argc, "Option '--trace' expects a file name.");
+         traceFile = argv[++i];
+      } else if (argument == "--profile") {
+         assert(i + 1 < argc, "Option '--profile' expects a file name.");
+         profileFile = argv[++i];
+      } else if (argument == "--decode") {
+         assert(i + 2 < argc, "Option '--decode' expects a trace file and the traced file or code.");
+         std::string source = argv[i + 2];
+         decodeTrace(argv[i + 1], (isFile(source) ? readFile(source) : source));
+         return 0;
+      } else if (!socketPath.empty()) {
+         programs.push_back(argument);
+      } else {
+         assert(input.empty(), "Expected a single file or code argument, got '{}' as well. See '-h' for more info.", argument);
+         input = argument;
+      }
+   }
+
+   if (!socketPath.empty()) {
+      if (!input.empty()) {
+         programs.insert(programs.begin(), input);
+      }
+      assert(!programs.empty(), "Option '--serve' expects at least one program file.");
+
+      Server server (socketPath, workers, timeout);
+      for (const std::string &file: programs) {
+         server.load(file);
+      }
+      server.run();
+   }
+   assert(!input.empty(), "Expected a file or code argument. See '-h' for more info.");
+   assert(recordFile.empty() || replayFile.empty(), "Options '--record' and '--replay' cannot be used together.");
 
    if (isFile(input)) {
       input = readFile(input);
    }
 
-   Interpreter interpreter;
-   interpreter.run(input);
-   return 0;
+   // A monotonic arena makes allocations a pointer bump and frees everything at once on teardown
+   std::vector<std::byte> arenaBuffer (arenaSize);
+   std::unique_ptr<std::pmr::monotonic_buffer_resource> arena;
+   if (useArena) {
+      arena = (arenaSize ? std::make_unique<std::pmr::monotonic_buffer_resource>(arenaBuffer.data(), arenaBuffer.size()) : std::make_unique<std::pmr::monotonic_buffer_resource>());
+   }
+
+   Interpreter interpreter (arena ? arena.get() : std::pmr::get_default_resource());
+
+   std::unique_ptr<Replay> replay;
+   if (!recordFile.empty() || !replayFile.empty()) {
+      replay = (recordFile.empty() ? std::make_unique<Replay>(Replay::Mode::replay, replayFile) : std::make_unique<Replay>(Replay::Mode::record, recordFile));
+      interpreter.replay = replay.get();
+      Replay::install(replay.get());
+
+      // The generator is deterministic, so recording its seed is enough to reproduce every random value
+      auto generate = [seeded, seed]() {
+         return std::to_string((seeded ? seed : std::random_device()()));
+      };
+      seed = std::stoull(replay->text('N', generate));
+      seeded = true;
+   }
+
+   if (seeded) {
+      interpreter.random.seed(seed);
+   }
+
+   std::unique_ptr<Trace> trace;
+   if (!traceFile.empty()) {
+      trace = std::make_unique<Trace>(traceFile);
+      interpreter.trace = trace.get();
+      Trace::install(trace.get());
+   }
+
+   std::unique_ptr<Profiler> profiler;
+   if (!profileFile.empty()) {
+      profiler = std::make_unique<Profiler>(profileFile);
+      interpreter.profiler = profiler.get();
+      Profiler::install(profiler.get());
+   }
+
+   std::unique_ptr<LoopDetector> detector;
+   if (detectLoops) {
+      detector = std::make_unique<LoopDetector>(detectInterval);
+      interpreter.detector = detector.get();
+   }
+
+   std::unique_ptr<Stats> stats;
+   if (collectStats) {
+      stats = std::make_unique<Stats>();
+      stats->interpreter = &interpreter;
+      stats->json = statsJson;
+      interpreter.stats = stats.get();
+      Stats::install(stats.get());
+   }
+
+   if (!useSession) {
+      interpreter.run(input);
+      return 0;
+   }
+
+   // Only read stdin when the program is waiting for input, the same way a host multiplexing sessions would
+   Session session = interpreter.session(input);
+   while (session.resume()) {
+      char buffer[4096];
+      ssize_t size = read(STDIN_FILENO, buffer, sizeof(buffer));
+      if (size > 0) {
+         interpreter.feed(std::string_view(buffer, size));
+      } else {
+         interpreter.closeInput();
+      }
+   }
+
+   // Exit like 'E' does, or like an error outside a session, the exit hooks still point at the trace, stats and replay above
+   if (!session.error().empty()) {
+      raise("{}", session.error());
+   }
+   std::exit(0);
 }
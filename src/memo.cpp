@@ -0,0 +1,285 @@
+#include "format.hpp" // IWYU pragma: export
+#include "interpreter.hpp"
+#include <algorithm>
+#include <tuple>
+#include <utility>
+
+// Memo hash
+
+size_t MemoHash::operator()(const std::pmr::vector<int> &values) const {
+   size_t hash = values.size();
+   for (int value: values) {
+      hash ^= std::hash<int>()(value) + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+   }
+   return hash;
+}
+
+// Memo
+
+Memo::Memo(allocator_type allocator): results(allocator) {}
+
+Memo::Memo(const Memo &memo, allocator_type allocator): consumed(memo.consumed), produced(memo.produced), results(memo.results, allocator) {}
+
+Memo::Memo(Memo &&memo, allocator_type allocator): consumed(memo.consumed), produced(memo.produced), results(std::move(memo.results), allocator) {}
+
+// Analysis
+
+void Interpreter::analyzeMemos() {
+   // Effects are (consumed, change in stack size) per label. A label starts out unknown, gets an effect
+   // once an 'R' is reachable and is dropped for good once anything other than stack work is reachable.
+   // Recursive calls use the effect found so far, so this repeats until nothing changes.
+   std::unordered_map<std::string, std::pair<int, int>> effects;
+   std::unordered_set<std::string> impure;
+
+   bool changed = true;
+   while (changed) {
+      changed = false;
+      for (auto &[label, position]: labels) {
+         std::string name (label);
+         if (impure.contains(name)) {
+            continue;
+         }
+
+         std::optional<std::pair<int, int>> effect;
+         auto known = effects.find(name);
+
+         if (!memoEffect(position, effects, impure, effect) || (known != effects.end() && effect && known->second.second != effect->second)) {
+            impure.insert(name);
+            effects.erase(name);
+            changed = true;
+         } else if (effect && known == effects.end()) {
+            effects[name] = *effect;
+            changed = true;
+         } else if (effect && effect->first > known->second.first) {
+            known->second.first = effect->first;
+            changed = true;
+         }
+      }
+   }
+
+   for (auto &[name, effect]: effects) {
+      Memo &memo = memos[std::pmr::string(name, resource)];
+      memo.consumed = effect.first;
+      memo.produced = effect.first + effect.second;
+   }
+}
+
+bool Interpreter::memoEffect(Vector2 start, const std::unordered_map<std::string, std::pair<int, int>> &effects, const std::unordered_set<std::string> &impure, std::optional<std::pair<int, int>> &effect) const {
+   constexpr int maximumHeight = 256;
+   constexpr size_t maximumStates = 1 << 16;
+
+   Vector2 size;
+   for (auto &[cell, token]: map) {
+      size.x = std::max(size.x, cell.x + 1);
+      size.y = std::max(size.y, cell.y + 1);
+   }
+   auto inside = [&size](Vector2 cell) {
+      return cell.x >= 0 && cell.y >= 0 && cell.x < size.x && cell.y < size.y;
+   };
+   auto advance = [](Vector2 &cell, Vector2 direction) {
+      cell = {cell.x + direction.x, cell.y + direction.y};
+   };
+
+   // Heights are relative to the stack at the call, the lowest one reached is what the label consumes
+   std::vector<std::tuple<Vector2, Vector2, int>> pending {{start, {1, 0}, 0}};
+   std::unordered_set<long long> visited;
+   int lowest = 0;
+
+   while (!pending.empty()) {
+      auto [cell, direction, height] = pending.back();
+      pending.pop_back();
+
+      while (inside(cell)) {
+         if (height < -maximumHeight || height > maximumHeight || visited.size() > maximumStates) {
+            return false;
+         }
+
+         long long state = ((((static_cast<long long>(cell.y) * size.x + cell.x) << 2) | directionIndex(direction)) << 10) | (height + maximumHeight);
+         if (!visited.insert(state).second) {
+            break;
+         }
+
+         Token command = tokenAt(cell);
+         int pops = 0, pushes = 0;
+         bool ended = false;
+
+         switch (command.type) {
+            case Token::empty:
+            case Token::bridge:
+               break;
+            case Token::right: direction = {1, 0}; break;
+            case Token::left: direction = {-1, 0}; break;
+            case Token::up: direction = {0, -1}; break;
+            case Token::down: direction = {0, 1}; break;
+
+            case Token::rightCondition:
+            case Token::leftCondition:
+            case Token::upCondition:
+            case Token::downCondition: {
+               const Vector2 turns[] {{1, 0}, {-1, 0}, {0, -1}, {0, 1}};
+               Vector2 turn = turns[command.type - Token::rightCondition];
+               lowest = std::min(lowest, height - 1);
+               pending.push_back({{cell.x + turn.x, cell.y + turn.y}, turn, height - 1});
+               pops = 1;
+               break;
+            }
+
+            case Token::number:
+            case Token::ten:
+               pushes = 1;
+               break;
+            case Token::add:
+            case Token::subtract:
+            case Token::multiply:
+            case Token::divide:
+            case Token::greaterThan:
+            case Token::equals:
+               pops = 2, pushes = 1;
+               break;
+            case Token::increment:
+            case Token::decrement:
+            case Token::negate:
+            case Token::logical_not:
+               pops = 1, pushes = 1;
+               break;
+            case Token::duplicate:
+               pops = 1, pushes = 2;
+               break;
+            case Token::swap:
+               pops = 2, pushes = 2;
+               break;
+            case Token::pop:
+               pops = 1;
+               break;
+
+            case Token::stringmode: {
+               // Pushes every cell up to the closing '"', which then runs as usual
+               int length = 0;
+               advance(cell, direction);
+               while (inside(cell) && tokenAt(cell).type != Token::stringmode) {
+                  length += 1;
+                  advance(cell, direction);
+               }
+               if (!inside(cell)) {
+                  return false;
+               }
+               pushes = length;
+               break;
+            }
+
+            case Token::numbermode: {
+               // Hexadecimal numbers switch every later number to hexadecimal, which is state outside the stack
+               bool digits = false;
+               advance(cell, direction);
+               if (tokenAt(cell).value == 'X') {
+                  return false;
+               }
+               while (tokenAt(cell).type == Token::number) {
+                  digits = true;
+                  advance(cell, direction);
+               }
+
+               height += digits;
+               continue;
+            }
+
+            case Token::jumpToLabel: {
+               std::string name;
+               advance(cell, direction);
+               while (std::isalnum(tokenAt(cell).value) || tokenAt(cell).value == '_') {
+                  name += tokenAt(cell).value;
+                  advance(cell, direction);
+               }
+
+               // The cell ending the name runs inside the label, only calls without one are followed
+               if (impure.contains(name) || tokenAt(cell).type != Token::empty) {
+                  return false;
+               }
+
+               auto callee = effects.find(name);
+               if (callee == effects.end()) {
+                  ended = true; // Not known to return yet, or not a label at all
+               } else {
+                  lowest = std::min(lowest, height - callee->second.first);
+                  height += callee->second.second;
+               }
+               break;
+            }
+
+            case Token::return_:
+               if (effect && effect->second != height) {
+                  return false;
+               }
+               effect = {0, height};
+               ended = true;
+               break;
+
+            default:
+               // Output, input, registers, variables, functions, deferred commands and the stack size
+               return false;
+         }
+
+         if (ended) {
+            break;
+         }
+
+         lowest = std::min(lowest, height - pops);
+         height += pushes - pops;
+
+         if (command.type == Token::bridge) {
+            advance(cell, direction);
+         }
+         advance(cell, direction);
+      }
+   }
+
+   if (effect) {
+      effect->first = -lowest;
+   }
+   return true;
+}
+
+// Runtime
+
+bool Interpreter::recallMemo(Token command) {
+   // Mode flags that change what the label's commands do aren't part of the key, so calls with them set run normally
+   if (command.type != Token::empty || hexadecimalNumber || outputString || reverseString) {
+      return false;
+   }
+
+   auto it = memos.find(identifier);
+   if (it == memos.end() || stack.size() < static_cast<size_t>(it->second.consumed)) {
+      return false;
+   }
+
+   Memo &memo = it->second;
+   std::pmr::vector<int> inputs (stack.c.end() - memo.consumed, stack.c.end(), resource);
+
+   auto result = memo.results.find(inputs);
+   if (result != memo.results.end()) {
+      stack.c.erase(stack.c.end() - memo.consumed, stack.c.end());
+      stack.c.insert(stack.c.end(), result->second.begin(), result->second.end());
+      return true;
+   }
+
+   // The result is only known once the call's own frame is popped, calls without a frame just run
+   if (!(command.frameless & (1 << directionIndex(direction)))) {
+      memoCalls.push({&memo, std::move(inputs), jumps.size() + 1});
+   }
+   return false;
+}
+
+void Interpreter::storeMemo() {
+   MemoCall call = std::move(memoCalls.top());
+   memoCalls.pop();
+
+   Memo &memo = *call.memo;
+   if (stack.size() < static_cast<size_t>(memo.produced)) {
+      return;
+   }
+
+   if (memo.results.size() >= Memo::capacity) {
+      memo.results.clear();
+   }
+   memo.results.emplace(std::move(call.inputs), std::pmr::vector<int>(stack.c.end() - memo.produced, stack.c.end(), resource));
+}
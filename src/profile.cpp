@@ -0,0 +1,82 @@
+#include "format.hpp" // IWYU pragma: export
+#include "profile.hpp"
+#include <fstream>
+#include <sys/time.h>
+
+static Profiler *activeProfiler = nullptr;
+
+Profiler::Profiler(const std::string &filename): filename(filename) {}
+
+// Name of the label called at a jump, read back from the ';name' before the cell the jump returns to
+static std::string calledLabel(const Interpreter &interpreter, Vector2 position, Vector2 direction) {
+   std::string name;
+   Vector2 cell = {position.x - direction.x, position.y - direction.y};
+
+   while (true) {
+      char value = interpreter.tokenAt(cell).value;
+      if (value == ';') {
+         return name;
+      }
+      if (!std::isalnum(value) && value != '_') {
+         return "?";
+      }
+
+      name.insert(name.begin(), value);
+      cell = {cell.x - direction.x, cell.y - direction.y};
+   }
+}
+
+void Profiler::sample(const Interpreter &interpreter) {
+   pending = 0;
+   count += 1;
+
+   // One frame per active label, calls that needed no frame are folded into their caller
+   std::string stack = "main";
+   for (const Frame &frame: interpreter.jumps.c) {
+      stack += ';';
+      stack += calledLabel(interpreter, frame.position, frame.direction);
+   }
+   samples[stack] += 1;
+}
+
+void Profiler::write() {
+   itimerval stop {};
+   setitimer(ITIMER_PROF, &stop, nullptr);
+
+   std::ofstream file (filename, std::ios::out | std::ios::trunc);
+   if (!file.is_open()) {
+      warn("Could not write profile '{}'.", filename);
+      return;
+   }
+
+   for (auto &[stack, total]: samples) {
+      file << stack << ' ' << total << '\n';
+   }
+   std::cerr << "PROFILE: " << count << " samples written to '" << filename << "'.\n";
+}
+
+static void handleProfileSignal(int) {
+   Profiler::pending = 1;
+}
+
+static void writeActiveProfile() {
+   if (activeProfiler) {
+      activeProfiler->write();
+   }
+}
+
+void Profiler::install(Profiler *profiler) {
+   activeProfiler = profiler;
+   std::atexit(writeActiveProfile);
+
+   struct sigaction action {};
+   action.sa_handler = handleProfileSignal;
+   action.sa_flags = SA_RESTART;
+   sigemptyset(&action.sa_mask);
+   sigaction(SIGPROF, &action, nullptr);
+
+   itimerval timer {};
+   timer.it_interval.tv_usec = 1000000 / frequency;
+   timer.it_value = timer.it_interval;
+   setitimer(ITIMER_PROF, &timer, nullptr);
+}
@@ -0,0 +1,62 @@
+#include "random.hpp"
+#include <utility>
+
+static uint64_t rotateLeft(uint64_t value, int count) {
+   return (value << count) | (value >> (64 - count));
+}
+
+void Random::seed(uint64_t value) {
+   // Expand the seed with splitmix64 so that similar seeds give unrelated states
+   for (uint64_t &word: state) {
+      value += 0x9e3779b97f4a7c15;
+      uint64_t z = value;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+      word = z ^ (z >> 31);
+   }
+}
+
+uint64_t Random::next() {
+   uint64_t result = rotateLeft(state[1] * 5, 7) * 9;
+   uint64_t t = state[1] << 17;
+
+   state[2] ^= state[0];
+   state[3] ^= state[1];
+   state[1] ^= state[2];
+   state[0] ^= state[3];
+   state[2] ^= t;
+   state[3] = rotateLeft(state[3], 45);
+   return result;
+}
+
+int Random::integer() {
+   return next() >> 33;
+}
+
+int Random::range(int min, int max) {
+   if (min > max) {
+      std::swap(min, max);
+   }
+
+   // Lemire's multiply-shift method, rejecting the few values that would bias the result
+   uint64_t span = static_cast<uint64_t>(static_cast<int64_t>(max) - min) + 1;
+   if (span > UINT32_MAX) {
+      return static_cast<int>(next() >> 32);
+   }
+
+   uint64_t product = (next() >> 32) * span;
+   uint32_t low = static_cast<uint32_t>(product);
+
+   if (low < span) {
+      uint32_t threshold = static_cast<uint32_t>(-span) % static_cast<uint32_t>(span);
+      while (low < threshold) {
+         product = (next() >> 32) * span;
+         low = static_cast<uint32_t>(product);
+      }
+   }
+   return static_cast<int>(min + static_cast<int64_t>(product >> 32));
+}
+
+bool Random::condition() {
+   return next() >> 63;
+}
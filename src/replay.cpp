@@ -0,0 +1,140 @@
+#include "format.hpp" // IWYU pragma: export
+#include "replay.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+static Replay *activeReplay = nullptr;
+static constexpr const char *replayHeader = "DFUNGE-REPLAY 1";
+
+// Tee buffer
+
+int TeeBuffer::overflow(int character) {
+   if (character != traits_type::eof()) {
+      captured.push_back(character);
+      return target->sputc(character);
+   }
+   return traits_type::not_eof(character);
+}
+
+std::streamsize TeeBuffer::xsputn(const char *data, std::streamsize size) {
+   captured.append(data, size);
+   return target->sputn(data, size);
+}
+
+int TeeBuffer::sync() {
+   return target->pubsync();
+}
+
+// Replay
+
+Replay::Replay(Mode mode, const std::string &filename)
+   : mode(mode), filename(filename) {
+   if (mode == Mode::record) {
+      log.open(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+      assert(log.is_open(), "Could not create recording '{}'.", filename);
+      log << replayHeader << '\n';
+   } else {
+      std::ifstream file (filename, std::ios::binary);
+      assert(file.is_open(), "Could not read recording '{}'.", filename);
+
+      std::string header;
+      std::getline(file, header);
+      assert(header == replayHeader, "File '{}' is not a Dfunge recording.", filename);
+
+      Event event;
+      size_t size = 0;
+      while (file >> event.kind >> size && file.get() == '\n') {
+         event.value.resize(size);
+         file.read(event.value.data(), size);
+         assert(file.gcount() == static_cast<std::streamsize>(size) && file.get() == '\n', "Recording '{}' is truncated.", filename);
+
+         if (event.kind == 'O') {
+            expectedOutput = event.value;
+         } else {
+            events.push_back(event);
+         }
+      }
+   }
+
+   // Capture everything written to standard output, so runs can be compared
+   output.target = std::cout.rdbuf();
+   originalOutput = std::cout.rdbuf(&output);
+}
+
+int Replay::integer(char kind, const std::function<int()> &live) {
+   if (mode == Mode::replay) {
+      Event event = next(kind);
+      try {
+         return std::stoi(event.value);
+      } catch (...) {
+         raise("Recording '{}' has an invalid value '{}'.", filename, event.value);
+      }
+   }
+
+   int value = live();
+   write(kind, std::to_string(value));
+   return value;
+}
+
+std::string Replay::text(char kind, const std::function<std::string()> &live) {
+   if (mode == Mode::replay) {
+      return next(kind).value;
+   }
+
+   std::string value = live();
+   write(kind, value);
+   return value;
+}
+
+void Replay::write(char kind, const std::string &value) {
+   log << kind << ' ' << value.size() << '\n';
+   log.write(value.data(), value.size());
+   log << '\n' << std::flush;
+}
+
+Replay::Event Replay::next(char kind) {
+   assert(!events.empty(), "Recording '{}' has no more events, expected '{}'. The program took a different path than when it was recorded.", filename, kind);
+   Event event = events.front();
+   events.pop_front();
+
+   assert(event.kind == kind, "Recording '{}' has event '{}', expected '{}'. The program took a different path than when it was recorded.", filename, event.kind, kind);
+   return event;
+}
+
+void Replay::finish() {
+   std::cout << std::flush;
+   std::cout.rdbuf(originalOutput);
+
+   if (mode == Mode::record) {
+      write('O', output.captured);
+      return;
+   }
+
+   if (output.captured == expectedOutput) {
+      std::cerr << "REPLAY: Output matches the recording.\n";
+      return;
+   }
+
+   size_t index = 0;
+   while (index < output.captured.size() && index < expectedOutput.size() && output.captured[index] == expectedOutput[index]) {
+      index += 1;
+   }
+   std::cerr << "REPLAY: Output differs from the recording at byte " << index << " (got " << output.captured.size() << " bytes, recorded " << expectedOutput.size() << ").\n";
+
+   // This runs from an exit handler, where calling exit again isn't allowed. The replay is installed
+   // before the other exit hooks, so they have all run by now.
+   std::cout << std::flush;
+   std::fflush(nullptr);
+   std::_Exit(1);
+}
+
+static void finishActiveReplay() {
+   if (activeReplay) {
+      activeReplay->finish();
+   }
+}
+
+void Replay::install(Replay *replay) {
+   activeReplay = replay;
+   std::atexit(finishActiveReplay);
+}
@@ -0,0 +1,107 @@
+#include "scheduler.hpp"
+#include <algorithm>
+#include <cstdint>
+
+static thread_local size_t workerIndex = SIZE_MAX;
+
+Scheduler::Scheduler(size_t workers)
+   : workers(workers) {
+   for (size_t i = 0; i <= workers; ++i) {
+      queues.push_back(std::make_unique<Queue>());
+   }
+
+   for (size_t i = 0; i < workers; ++i) {
+      std::thread(&Scheduler::work, this, i).detach();
+   }
+}
+
+Scheduler &Scheduler::instance() {
+   // Created on first use so single-IP programs never start threads. Never
+   // destroyed, since workers may still be running IPs when the program exits.
+   static Scheduler *scheduler = new Scheduler(std::max(1u, std::thread::hardware_concurrency()));
+   return *scheduler;
+}
+
+std::shared_ptr<Scheduler::Job> Scheduler::submit(std::function<void()> task) {
+   auto job = std::make_shared<Job>();
+   job->task = std::move(task);
+
+   Queue &queue = *queues[ownQueue()];
+   {
+      std::lock_guard lock (queue.mutex);
+      queue.jobs.push_back(job);
+   }
+   pending += 1;
+   sleep.notify_one();
+   return job;
+}
+
+void Scheduler::wait(Job &job) {
+   // Running a job that hasn't started yet here, instead of anything else that is queued, keeps a wait from
+   // deadlocking when every worker is waiting too, and from getting stuck behind unrelated work
+   if (!job.claimed.exchange(true)) {
+      run(job);
+   }
+   job.done.wait(false);
+}
+
+bool Scheduler::runOne() {
+   if (pending == 0) {
+      return false;
+   }
+
+   std::shared_ptr<Job> job;
+   size_t own = ownQueue();
+
+   for (size_t i = 0; i < queues.size() && !job; ++i) {
+      size_t index = (own + i) % queues.size();
+      Queue &queue = *queues[index];
+      std::lock_guard lock (queue.mutex);
+
+      if (queue.jobs.empty()) {
+         continue;
+      }
+
+      if (index == own) {
+         job = std::move(queue.jobs.back());
+         queue.jobs.pop_back();
+      } else {
+         job = std::move(queue.jobs.front());
+         queue.jobs.pop_front();
+      }
+   }
+
+   if (!job) {
+      return false;
+   }
+   pending -= 1;
+
+   // Already run by a thread waiting for it
+   if (!job->claimed.exchange(true)) {
+      run(*job);
+   }
+   return true;
+}
+
+void Scheduler::run(Job &job) {
+   job.task();
+   job.done = true;
+   job.done.notify_all();
+}
+
+size_t Scheduler::ownQueue() const {
+   return (workerIndex < workers ? workerIndex : workers);
+}
+
+void Scheduler::work(size_t index) {
+   workerIndex = index;
+
+   while (true) {
+      if (!runOne()) {
+         std::unique_lock lock (sleepMutex);
+         sleep.wait_for(lock, std::chrono::milliseconds(10), [this]() {
+            return pending > 0;
+         });
+      }
+   }
+}
@@ -0,0 +1,119 @@
+#include "file.hpp"
+#include "format.hpp" // IWYU pragma: export
+#include "server.hpp"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+Server::Server(const std::string &path, int workers, unsigned timeout): path(path), workers(workers), timeout(timeout) {}
+
+void Server::load(const std::string &file) {
+   assert(isFile(file), "Server: '{}' is not a file.", file);
+
+   // Requests name programs by file name without the extension
+   std::string name = std::filesystem::path(file).stem().string();
+   assert(!programs.contains(name), "Server: More than one program is named '{}'.", name);
+
+   auto interpreter = std::make_unique<Interpreter>();
+   interpreter->lex(readFile(file));
+   programs[name] = std::move(interpreter);
+}
+
+void Server::run() {
+   sockaddr_un address {};
+   address.sun_family = AF_UNIX;
+   assert(path.size() < sizeof(address.sun_path), "Server: Socket path '{}' is too long.", path);
+   std::strcpy(address.sun_path, path.c_str());
+
+   listener = socket(AF_UNIX, SOCK_STREAM, 0);
+   assert(listener >= 0, "Server: Could not create a socket: {}.", std::strerror(errno));
+
+   // Only a socket left behind by an earlier server is replaced, never a file that happens to have the name
+   struct stat status {};
+   if (lstat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+      unlink(path.c_str());
+   }
+   // The calls come first, arguments to assert are evaluated in any order and could read errno before them
+   bool bound = (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0);
+   assert(bound, "Server: Could not bind to '{}': {}.", path, std::strerror(errno));
+   bool listening = (listen(listener, SOMAXCONN) == 0);
+   assert(listening, "Server: Could not listen on '{}': {}.", path, std::strerror(errno));
+
+   std::cerr << "SERVER: Listening on '" << path << "' with " << workers << " workers, " << programs.size() << " programs.\n";
+
+   for (int i = 0; i < workers; ++i) {
+      spawn();
+   }
+
+   // Replace every worker as soon as it has served its request
+   while (true) {
+      pid_t worker = wait(nullptr);
+      if (worker > 0) {
+         spawn();
+      } else if (errno != EINTR) {
+         raise("Server: Lost track of workers: {}.", std::strerror(errno));
+      }
+   }
+}
+
+void Server::spawn() {
+   pid_t worker = fork();
+   assert(worker >= 0, "Server: Could not start a worker: {}.", std::strerror(errno));
+
+   if (worker == 0) {
+      #ifdef __linux__
+      // Workers waiting for a connection would otherwise outlive a stopped server
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      #endif
+      work();
+   }
+}
+
+void Server::work() {
+   int connection = -1;
+   while ((connection = accept(listener, nullptr, nullptr)) < 0) {
+      assert(errno == EINTR || errno == ECONNABORTED, "Server: Could not accept a connection: {}.", std::strerror(errno));
+   }
+   close(listener);
+
+   // Hung or endless programs would keep the worker from ever being replaced, so both end it: the alarm
+   // after the deadline, and SIGPIPE on the first write once the client has gone
+   std::signal(SIGPIPE, SIG_DFL);
+   std::signal(SIGALRM, SIG_DFL);
+   alarm(timeout);
+
+   // Read the name a byte at a time, everything after it belongs to the program
+   std::string name;
+   char character = 0;
+   while (read(connection, &character, 1) == 1 && character != '\n') {
+      name += character;
+   }
+   if (!name.empty() && name.back() == '\r') {
+      name.pop_back();
+   }
+
+   dup2(connection, STDIN_FILENO);
+   dup2(connection, STDOUT_FILENO);
+   close(connection);
+
+   assert(programs.contains(name), "Server: Program '{}' is not loaded.", name);
+   Interpreter &interpreter = *programs[name];
+
+   // Workers are forked from the same state, so each needs its own seed
+   interpreter.random.seed(std::random_device()());
+   interpreter.execute();
+
+   std::cout << std::flush;
+   std::exit(0);
+}
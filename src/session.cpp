@@ -0,0 +1,183 @@
+#include "format.hpp" // IWYU pragma: export
+#include "interpreter.hpp"
+#include "session.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <utility>
+
+#ifdef __linux__
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+// Session
+
+Session Session::promise_type::get_return_object() {
+   return Session(std::coroutine_handle<promise_type>::from_promise(*this));
+}
+
+void Session::promise_type::unhandled_exception() {
+   try {
+      throw;
+   } catch (const std::exception &exception) {
+      error = exception.what();
+   }
+}
+
+Session::Session(std::coroutine_handle<promise_type> handle): handle(handle) {}
+
+Session::Session(Session &&other) noexcept: handle(std::exchange(other.handle, nullptr)) {}
+
+Session &Session::operator=(Session &&other) noexcept {
+   if (this != &other) {
+      if (handle) {
+         handle.destroy();
+      }
+      handle = std::exchange(other.handle, nullptr);
+   }
+   return *this;
+}
+
+Session::~Session() {
+   if (handle) {
+      handle.destroy();
+   }
+}
+
+bool Session::resume() {
+   if (!done()) {
+      // The host owns the process, so errors are thrown up to the promise instead of exiting
+      bool throws = std::exchange(raiseThrows, true);
+      handle.resume();
+      raiseThrows = throws;
+   }
+   return !done();
+}
+
+bool Session::done() const {
+   return !handle || handle.done();
+}
+
+std::string Session::error() const {
+   return (handle ? handle.promise().error : "");
+}
+
+// Interpreter
+
+Session Interpreter::session(std::string code) {
+   // The host owns the process, 'E' only ends this session
+   ownsProcess = false;
+   suspendOnInput = true;
+
+   if (stats) {
+      stats->beginLex();
+   }
+   lex(code);
+
+   if (stats) {
+      stats->beginRun();
+   }
+   while (!terminated) {
+      step();
+      if (waitingForInput) {
+         co_await std::suspend_always();
+         resuming = true;
+      }
+   }
+   *output << std::flush;
+}
+
+void Interpreter::feed(std::string_view data) {
+   input.append(data);
+   waitingForInput = false;
+}
+
+void Interpreter::closeInput() {
+   inputClosed = true;
+   waitingForInput = false;
+}
+
+// Input
+
+bool Interpreter::inputReady(Token::Type type) {
+   if (!suspendOnInput || inputClosed) {
+      return true;
+   }
+
+   bool ready = true;
+   if (type == Token::integerInput) {
+      // Like 'std::cin >> num', skips blank lines and then takes the rest of the line
+      size_t start = input.find_first_not_of(" \t\n\r\f\v");
+      ready = (start != std::pmr::string::npos && input.find('\n', start) != std::pmr::string::npos);
+   } else if (type == Token::asciiInput) {
+      ready = !input.empty();
+   } else if (type == Token::stringInput) {
+      ready = (input.find('\n') != std::pmr::string::npos);
+   }
+
+   // Waiting is an interaction too, whatever gets fed decides what the program does next
+   if (!ready) {
+      interactions += 1;
+   }
+   waitingForInput = !ready;
+   return ready;
+}
+
+int Interpreter::readInteger() {
+   int num = 0;
+   if (!suspendOnInput) {
+      std::cin >> num;
+      std::cin.clear();
+      std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+      return num;
+   }
+
+   size_t start = input.find_first_not_of(" \t\n\r\f\v");
+   size_t end = (start == std::pmr::string::npos ? input.size() : std::min(input.find('\n', start), input.size()));
+
+   std::istringstream line (std::string(input.begin() + std::min(start, end), input.begin() + end));
+   line >> num;
+   input.erase(0, std::min(end + 1, input.size()));
+   return num;
+}
+
+int Interpreter::readCharacter() {
+   if (!suspendOnInput) {
+      #ifdef __linux__
+      termios oldt, newt;
+      tcgetattr(STDIN_FILENO, &oldt);
+      newt = oldt;
+      newt.c_lflag &= ~(ICANON | ECHO);
+
+      tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+      char ch = getchar();
+      tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+      #else
+      char ch = getchar();
+      #endif
+      return ch;
+   }
+
+   // Closed and empty reads as end of file, the same as 'getchar'
+   char ch = (input.empty() ? static_cast<char>(EOF) : input.front());
+   if (!input.empty()) {
+      input.erase(0, 1);
+   }
+   return ch;
+}
+
+std::string Interpreter::readLine() {
+   std::string line;
+   if (!suspendOnInput) {
+      std::getline(std::cin, line);
+      return line;
+   }
+
+   size_t end = std::min(input.find('\n'), input.size());
+   line.assign(input.begin(), input.begin() + end);
+   input.erase(0, std::min(end + 1, input.size()));
+   return line;
+}
@@ -0,0 +1,74 @@
+#include "format.hpp" // IWYU pragma: export
+#include "stats.hpp"
+#include <algorithm>
+#include <vector>
+
+static Stats *activeStats = nullptr;
+
+void Stats::beginLex() {
+   lexStart = Clock::now();
+}
+
+void Stats::beginRun() {
+   runStart = Clock::now();
+   lexTime = runStart - lexStart;
+}
+
+void Stats::report() const {
+   double lexSeconds = std::chrono::duration<double>(lexTime).count();
+   double runSeconds = std::chrono::duration<double>(Clock::now() - runStart).count();
+   double stepsPerSecond = (runSeconds > 0 ? steps / runSeconds : 0);
+
+   const std::pair<const char *, const StatsSize *> sizes[] {
+      {"map", &map}, {"stack", &stack}, {"defered", &defered}, {"jumps", &jumps}, {"registers", &registers}, {"variables", &variables}
+   };
+
+   std::vector<std::pair<std::string, uint64_t>> calls (functionCalls.begin(), functionCalls.end());
+   std::sort(calls.begin(), calls.end(), [](const auto &a, const auto &b) {
+      return a.second != b.second ? a.second > b.second : a.first < b.first;
+   });
+
+   if (json) {
+      std::cerr << "{\"steps\": " << steps << ", \"lexSeconds\": " << lexSeconds << ", \"runSeconds\": " << runSeconds;
+      std::cerr << ", \"stepsPerSecond\": " << stepsPerSecond << ", \"sizes\": {";
+      for (size_t i = 0; i < std::size(sizes); ++i) {
+         std::cerr << (i ? ", " : "") << '"' << sizes[i].first << "\": {\"final\": " << sizes[i].second->final << ", \"peak\": " << sizes[i].second->peak << '}';
+      }
+      std::cerr << "}, \"functionCalls\": {";
+      for (size_t i = 0; i < calls.size(); ++i) {
+         std::cerr << (i ? ", " : "") << '"' << calls[i].first << "\": " << calls[i].second;
+      }
+      std::cerr << "}, \"bytesRead\": " << bytesRead << ", \"bytesWritten\": " << bytesWritten << "}\n";
+      return;
+   }
+
+   std::cerr << "STATS:\n";
+   std::cerr << "STEPS: " << steps << '\n';
+   std::cerr << "LEX TIME: " << lexSeconds << "s\n";
+   std::cerr << "RUN TIME: " << runSeconds << "s\n";
+   std::cerr << "STEPS PER SECOND: " << stepsPerSecond << '\n';
+   std::cerr << "SIZES (final / peak):\n";
+   for (auto &[name, size]: sizes) {
+      fprintf(stderr, "%12s: %zu / %zu\n", name, size->final, size->peak);
+   }
+   std::cerr << "FUNCTION CALLS:\n";
+   for (auto &[name, count]: calls) {
+      fprintf(stderr, "%12s: %llu\n", name.c_str(), static_cast<unsigned long long>(count));
+   }
+   std::cerr << "BYTES READ: " << bytesRead << '\n';
+   std::cerr << "BYTES WRITTEN: " << bytesWritten << '\n';
+   std::cerr << "END OF STATS\n";
+}
+
+static void reportActiveStats() {
+   if (activeStats) {
+      std::cout << std::flush;
+      activeStats->sample();
+      activeStats->report();
+   }
+}
+
+void Stats::install(Stats *stats) {
+   activeStats = stats;
+   std::atexit(reportActiveStats);
+}
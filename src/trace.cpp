@@ -0,0 +1,141 @@
+#include "format.hpp" // IWYU pragma: export
+#include "trace.hpp"
+#include <csignal>
+#include <fcntl.h>
+#include <fstream>
+#include <unistd.h>
+#include <vector>
+
+static Trace *activeTrace = nullptr;
+
+// Trace
+
+static bool writeAll(int file, const void *data, size_t size) {
+   const char *bytes = static_cast<const char *>(data);
+   while (size > 0) {
+      ssize_t written = write(file, bytes, size);
+      if (written <= 0) {
+         return false;
+      }
+      bytes += written;
+      size -= written;
+   }
+   return true;
+}
+
+Trace::Trace(const std::string &filename)
+   : filename(filename) {}
+
+void Trace::dump() const {
+   // Only uses async-signal-safe calls since this also runs from signal handlers
+   int file = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (file < 0) {
+      return;
+   }
+
+   uint32_t header[2] {magic, version};
+   size_t stored = (count < capacity ? count : capacity);
+   size_t oldest = (count < capacity ? 0 : count & (capacity - 1));
+
+   if (writeAll(file, header, sizeof(header)) && writeAll(file, &count, sizeof(count))) {
+      if (writeAll(file, records.data() + oldest, (stored - oldest) * sizeof(TraceRecord))) {
+         writeAll(file, records.data(), oldest * sizeof(TraceRecord));
+      }
+   }
+   close(file);
+}
+
+static void dumpActiveTrace() {
+   if (activeTrace) {
+      activeTrace->dump();
+   }
+}
+
+static void handleFatalSignal(int signal) {
+   dumpActiveTrace();
+   std::signal(signal, SIG_DFL);
+   std::raise(signal);
+}
+
+void Trace::install(Trace *trace) {
+   activeTrace = trace;
+   std::atexit(dumpActiveTrace);
+
+   for (int signal: {SIGINT, SIGTERM, SIGHUP, SIGSEGV, SIGBUS, SIGFPE, SIGABRT}) {
+      std::signal(signal, handleFatalSignal);
+   }
+}
+
+// Decoder
+
+static const char *directionName(int dx, int dy) {
+   if (dx == 1 && dy == 0) return "right";
+   if (dx == -1 && dy == 0) return "left";
+   if (dx == 0 && dy == -1) return "up";
+   if (dx == 0 && dy == 1) return "down";
+   return "?";
+}
+
+void decodeTrace(const std::string &traceFile, const std::string &code) {
+   std::ifstream file (traceFile, std::ios::binary);
+   assert(file.is_open(), "Could not read trace '{}'.", traceFile);
+
+   uint32_t header[2] {};
+   uint64_t count = 0;
+   file.read(reinterpret_cast<char *>(header), sizeof(header));
+   file.read(reinterpret_cast<char *>(&count), sizeof(count));
+   assert(file && header[0] == Trace::magic, "File '{}' is not a Dfunge trace.", traceFile);
+   assert(header[1] == Trace::version, "Trace '{}' has version {}, expected {}.", traceFile, header[1], Trace::version);
+
+   std::vector<TraceRecord> records (count < Trace::capacity ? count : Trace::capacity);
+   file.read(reinterpret_cast<char *>(records.data()), records.size() * sizeof(TraceRecord));
+   assert(file.gcount() == static_cast<std::streamsize>(records.size() * sizeof(TraceRecord)), "Trace '{}' is truncated.", traceFile);
+
+   // Split the source into rows the same way the lexer does
+   std::vector<std::string> grid (1);
+   for (char character: code) {
+      if (character == '\n') {
+         grid.emplace_back();
+      } else {
+         grid.back() += character;
+      }
+   }
+
+   auto cellAt = [&grid](int x, int y) -> char {
+      if (y < 0 || y >= static_cast<int>(grid.size()) || x < 0 || x >= static_cast<int>(grid[y].size())) {
+         return ' ';
+      }
+      return grid[y][x];
+   };
+
+   std::cout << "TRACE:\n";
+   std::cout << "STEPS: " << count << ", SHOWING LAST " << records.size() << '\n';
+   uint64_t step = count - records.size();
+
+   for (const TraceRecord &record: records) {
+      char opcode = (record.opcode ? record.opcode : ' ');
+      printf("%10llu: X: %-6d Y: %-6d Dir: %-5s Cmd: '%c' Top: %d", static_cast<unsigned long long>(step), record.x, record.y, directionName(record.dx, record.dy), opcode, record.top);
+      if (cellAt(record.x, record.y) != opcode) {
+         printf("  (source has '%c')", cellAt(record.x, record.y));
+      }
+      printf("\n");
+      step += 1;
+   }
+   std::cout << "END OF TRACE\n";
+
+   if (records.empty()) {
+      return;
+   }
+
+   const TraceRecord &last = records.back();
+   std::cout << "LAST POSITION:\n";
+   for (int y = last.y - 2; y <= last.y + 2; ++y) {
+      if (y < 0 || y >= static_cast<int>(grid.size())) {
+         continue;
+      }
+      printf("%5d| %s\n", y, grid[y].c_str());
+      if (y == last.y) {
+         printf("     | %s^\n", std::string(last.x < 0 ? 0 : last.x, ' ').c_str());
+      }
+   }
+}